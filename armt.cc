@@ -19,6 +19,7 @@
  */
 
 #include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/utsname.h>
@@ -26,6 +27,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 
 #include "common/CDNS.h"
 #include "common/CPCIInfo.h"
@@ -35,6 +37,9 @@
 #include "common/CCompress.h"
 #include "common/CMessageBuilder.h"
 #include "common/CScheduler.h"
+#include "common/CGovernor.h"
+#include "common/CMetrics.h"
+#include "common/CDataCache.h"
 
 #include "fs/CFSVerifier.h"
 #include "block/CBlockEnumerator.h"
@@ -52,12 +57,42 @@ extern "C" {
   }
 }
 
+/*
+ * Host data shared by the jobs through CDataCache, a job must declare the
+ * sources it reads so they are fresh and held for its run
+ */
+class CBlockSource: public IDataSource
+{
+  public:
+    virtual ~CBlockSource() { Free(); }
+
+    virtual void Refresh()
+    {
+      Free();
+      m_map = CBlockEnumerator::Enumerate();
+    }
+
+    const IBlockDevice::Map &GetMap() { return m_map; }
+
+  private:
+    IBlockDevice::Map m_map;
+
+    void Free()
+    {
+      for(IBlockDevice::Map::iterator it = m_map.begin(); it != m_map.end(); ++it)
+        delete it->second;
+      m_map.clear();
+    }
+};
+
+CBlockSource BlockSource;
+
 bool DISKCHECK(std::iostream &ss)
 {
   bool send = false;
 
-  IBlockDevice::Map map = CBlockEnumerator::Enumerate();
-  for(IBlockDevice::Map::iterator it = map.begin(); it != map.end(); ++it)
+  const IBlockDevice::Map &map = BlockSource.GetMap();
+  for(IBlockDevice::Map::const_iterator it = map.begin(); it != map.end(); ++it)
   {
     const std::string &error = it->second->GetError();
     if (!error.empty())
@@ -78,9 +113,20 @@ bool DISKCHECK(std::iostream &ss)
   return send;
 }
 
-bool FSCHECK(std::iostream &ss)
+/* keeps background work out of the way of the host's own workload */
+CGovernor Governor;
+
+bool METRICS(std::iostream &ss)
+{
+  return CMetrics::Pack(ss);
+}
+
+/* watches the protected paths between FSCHECK runs */
+CFSVerifier     FSMonitor;
+pthread_mutex_t FSMonitorLock = PTHREAD_MUTEX_INITIALIZER; /* serialises GetChanges */
+
+void FSSETUP(CFSVerifier &fs)
 {
-  CFSVerifier fs;
   fs.AddExclude("/boot/lost+found");
   fs.AddExclude("/usr/src");
   fs.AddExclude("/lib/init/rw");
@@ -100,43 +146,264 @@ bool FSCHECK(std::iostream &ss)
   fs.AddPath("/bin" , true);
   fs.AddPath("/sbin", true);
   fs.AddPath("/lib" , true);
+}
+
+/*
+ * FSCHECK hashes one shard of the protected files per run so the load is
+ * spread out, every file is still checked once per window
+ */
+#define FSCHECK_WINDOW 86400
+#define FSCHECK_SHARDS 24
+
+/* save FSCHECK's progress this often, in seconds */
+#define FSCHECK_CHECKPOINT 60
+
+/*
+ * The last FSCHECK, kept so the server can ask for its subtrees. The scan
+ * runs on a scheduler worker so these are only touched under FSLock.
+ */
+pthread_mutex_t         FSLock = PTHREAD_MUTEX_INITIALIZER;
+CFSVerifier            *FSChecker = NULL;
+CFSVerifier::StringList FSTreeRequests;
+bool                    FSFullRequested = false;
+bool                    FSPackagesPending = false;
+
+/* only one scan may use the stat cache at a time */
+pthread_mutex_t         FSScanLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the package database digests, files they match need not be sent, kept
+ * between runs and only used under FSScanLock */
+CPackageManifest        FSPackages;
+
+/* the shard of an FSCHECK that was interrupted by a restart */
+unsigned int            FSResumeShard;
+
+bool FSSCAN(std::iostream &ss, const unsigned int shard)
+{
+  pthread_mutex_lock(&FSScanLock);
+  CFSVerifier *checker = new CFSVerifier();
+  checker->SetCacheFile(CCommon::GetBasePath() + "/fscache");
+  checker->SetParanoid(7);
+  checker->SetCheckpoint(FSCHECK_CHECKPOINT);
+  checker->SetGovernor(&Governor);
+  checker->SetOrder(CFSVerifier::ORDER_EXTENT);
+  checker->SetShard(shard, FSCHECK_SHARDS);
+  FSSETUP(*checker);
+
+  /* verify package owned files against the package database, it is kept
+   * between runs and only loaded again once a package is installed */
+  if (FSPackages.Update())
+    checker->SetPackageManifest(&FSPackages);
+
+  /* scan for files and hash them, only the tree roots are sent */
+  checker->Scan();
+  pthread_mutex_unlock(&FSScanLock);
+
+  const CFSVerifier::ScanStats &stats = checker->GetStats();
+  CMetrics::Set("fscheck.files"        , stats.m_files   );
+  CMetrics::Set("fscheck.cached"       , stats.m_cached  );
+  CMetrics::Set("fscheck.bytes"        , stats.m_bytes   );
+  CMetrics::Set("fscheck.elapsed_ms"   , stats.m_elapsed );
+  CMetrics::Set("fscheck.syscalls"     , stats.m_syscalls);
+  CMetrics::Set("fscheck.latency_us"   , stats.m_latency );
+  CMetrics::Set("fscheck.packaged"     , stats.m_packaged);
+  CMetrics::Set("fscheck.checkpoints"  , stats.m_ckpt    );
+  CMetrics::Set("fscheck.checkpoint_ms", stats.m_ckptTime);
+
+  bool ret = checker->SaveSummary(ss);
+
+  /* replace the last check, requests for it are now out of date */
+  pthread_mutex_lock(&FSLock);
+  delete FSChecker;
+  FSChecker         = checker;
+  FSPackagesPending = !checker->GetPackageMismatches().empty();
+  FSTreeRequests.clear();
+  FSFullRequested   = false;
+  pthread_mutex_unlock(&FSLock);
+
+  return ret;
+}
+
+bool FSCHECK(std::iostream &ss)
+{
+  /* pick the shard from the clock so a restart carries on where it was */
+  const unsigned int interval = FSCHECK_WINDOW / FSCHECK_SHARDS;
+  return FSSCAN(ss, (time(NULL) / interval) % FSCHECK_SHARDS);
+}
+
+bool FSRESUME(std::iostream &ss)
+{
+  return FSSCAN(ss, FSResumeShard);
+}
+
+bool FSTREE(std::iostream &ss)
+{
+  pthread_mutex_lock(&FSLock);
+  bool ret = false;
+  if (FSChecker && !FSTreeRequests.empty())
+    ret = FSChecker->SaveTree(ss, FSTreeRequests);
+  FSTreeRequests.clear();
+  pthread_mutex_unlock(&FSLock);
+  return ret;
+}
+
+bool FSPKG(std::iostream &ss)
+{
+  pthread_mutex_lock(&FSLock);
+  bool ret = FSChecker && FSPackagesPending;
+  if (ret)
+  {
+    const CFSVerifier::DiffList &mismatches = FSChecker->GetPackageMismatches();
+    for(CFSVerifier::DiffList::const_iterator it = mismatches.begin(); it != mismatches.end(); ++it)
+      CMessageBuilder::PackString(ss, it->m_path);
+  }
+  FSPackagesPending = false;
+  pthread_mutex_unlock(&FSLock);
+  return ret;
+}
+
+bool FSFULL(std::iostream &ss)
+{
+  pthread_mutex_lock(&FSLock);
+  bool ret = FSChecker && FSFullRequested && FSChecker->Save(ss);
+  FSFullRequested = false;
+  pthread_mutex_unlock(&FSLock);
+  return ret;
+}
 
-  /* scan for files and hash them */
-  fs.Scan();
-  return fs.Save(ss);
+/**
+  * Parse the server's requests for FSCHECK details from a reply, one per
+  * line as "FSTREE <path>" for a directory's children or "FSFULL" for
+  * the whole baseline
+  * @return True if anything was requested
+  */
+bool FSREQUESTS(const std::string &reply)
+{
+  pthread_mutex_lock(&FSLock);
+  std::istringstream input(reply);
+  std::string        line;
+  while(std::getline(input, line))
+  {
+    if (!line.empty() && line[line.length() - 1] == '\r')
+      line.erase(line.length() - 1);
+
+    if (line.compare(0, 7, "FSTREE ") == 0)
+      FSTreeRequests.push_back(line.substr(7));
+    else if (line == "FSFULL")
+      FSFullRequested = true;
+  }
+
+  bool ret = !FSTreeRequests.empty() || FSFullRequested;
+  pthread_mutex_unlock(&FSLock);
+  return ret;
 }
 
+bool FSEVENT(std::iostream &ss)
+{
+  /* only report files that have been quiet for a few seconds */
+  CFSVerifier::DiffList changes;
+  pthread_mutex_lock(&FSMonitorLock);
+  bool ret = FSMonitor.GetChanges(changes, 5);
+  pthread_mutex_unlock(&FSMonitorLock);
+  if (!ret)
+    return false;
+
+  for(CFSVerifier::DiffList::iterator it = changes.begin(); it != changes.end(); ++it)
+  {
+    uint8_t type = it->m_type;
+    ss.write((const char *)&type, sizeof(type));
+    CMessageBuilder::PackString(ss, it->m_path);
+  }
+
+  return true;
+}
+
+/*
+ * reads the monitor's events as they arrive, FSEVENT reports them once they
+ * settle. This does not take FSMonitorLock as the verifier guards its dirty
+ * set itself, so events are not held up while FSEVENT is hashing
+ */
+class CFSEventHandler: public ISchedulerHandler
+{
+  public:
+    virtual void OnReadable(const int fd)
+    {
+      FSMonitor.ProcessEvents();
+    }
+};
+
+/*
+ * Collects a segment on a scheduler worker and appends it to the message
+ * once the run completes, the segment takes the job's name unless another
+ * is given
+ */
 class CMSGJob: public ISchedulerJob
 {
   public:
     CMSGJob(
       const std::time_t          next    ,
       const unsigned int         interval,
+      const unsigned int         timeout ,
       CMessageBuilder            *msg    ,
       const std::string          &name   ,
-      CMessageBuilder::SegmentFn fn
+      CMessageBuilder::SegmentFn fn      ,
+      const std::string          &segment = ""
     ) :
       m_next    (next    ),
       m_interval(interval),
+      m_timeout (timeout ),
       m_msg     (msg     ),
       m_name    (name    ),
-      m_fn      (fn      )
+      m_segment (segment.empty() ? name : segment),
+      m_fn      (fn      ),
+      m_ready   (false   )
     {}
 
     virtual std::time_t  GetRunTime(                ) { return m_next; }
     virtual void         SetRunTime(std::time_t time) { m_next = time; }
     virtual unsigned int GetDelayInterval(          ) { return m_interval; }
+    virtual unsigned int GetTimeout      (          ) { return m_timeout; }
+    virtual std::string  GetName         (          ) { return m_name; }
+
+    virtual void GetDependencies(std::vector<std::string> &deps)
+    {
+      deps.insert(deps.end(), m_deps.begin(), m_deps.end());
+    }
+
+    /**
+     * Declare a CDataCache source the job's function reads
+     */
+    CMSGJob *Depends(const std::string &source)
+    {
+      m_deps.push_back(source);
+      return this;
+    }
+
     virtual void Execute()
     {
-      m_msg->AppendSegment(m_name, m_fn);
+      std::stringstream ss;
+      m_ready = m_fn(ss);
+      m_data  = ss.str();
+    }
+
+    virtual void Complete()
+    {
+      if (m_ready)
+        m_msg->AppendSegment(m_segment, m_data);
+      m_data.clear();
     }
 
   private:
     std::time_t                m_next;
     unsigned int               m_interval;
+    unsigned int               m_timeout;
     CMessageBuilder           *m_msg;
     std::string                m_name;
+    std::string                m_segment;
     CMessageBuilder::SegmentFn m_fn;
+    std::vector<std::string>   m_deps;
+    bool                       m_ready;
+    std::string                m_data;
 };
 
 int main(int argc, char *argv[])
@@ -183,30 +450,102 @@ int main(int argc, char *argv[])
     return -1;
   }
 
-  /* calculate the GMT time for midnight tonight in the server's timezone */
-  tzset();
-  std::time_t midnight = time(NULL);
-  midnight -= midnight % 86400;
-  midnight += 86400;
-  midnight += timezone - (daylight * 3600);
- 
-  /* create and add the jobs to the scheduler */
+  /* keep what could not be sent while the server is unreachable, up to 64MiB */
+  if (!msg.SetSpool(CCommon::GetBasePath() + "/spool", 64 * 1024 * 1024))
+    fprintf(stderr, "Failed to open the message spool, messages will be lost while the server is unreachable\n");
+
+  /* start the rolling FSCHECK at the next shard boundary */
+  const unsigned int fsInterval = FSCHECK_WINDOW / FSCHECK_SHARDS;
+  std::time_t        fsNext     = time(NULL);
+  fsNext += fsInterval - fsNext % fsInterval;
+
+  /* limit reads to 32MiB/s and 200 IOPS at idle priority */
+  Governor.SetLimits(32 * 1024 * 1024, 200);
+  Governor.SetPriority(true, true, 19);
+  CCommon::SetCommandGovernor(&Governor);
+
+  /*
+   * watch the protected paths for changes, the monitor takes its digests
+   * from the stat cache so nothing is hashed until FSCHECK's shards run
+   */
+  FSMonitor.SetGovernor(&Governor);
+  FSMonitor.SetCacheFile(CCommon::GetBasePath() + "/fscache");
+  FSSETUP(FSMonitor);
+
+  /* an FSCHECK the last run did not complete is finished straight away */
+  unsigned int fsShards;
+  const bool   fsResume = FSMonitor.GetCheckpoint(FSResumeShard, fsShards) && fsShards == FSCHECK_SHARDS;
+
+  FSMonitor.ScanCached();
+  if (!FSMonitor.StartMonitor())
+    fprintf(stderr, "Failed to start the filesystem monitor\n");
+
+  /*
+   * the host data the jobs share, each is read at most once a cycle however
+   * many jobs use it, the TTL is a little under DISKCHECK's interval so each
+   * of its runs sees fresh data
+   */
+  CDataCache::Register("blockdevices", &BlockSource, 55000);
+
+  CMSGJob *diskCheck = new CMSGJob(time(NULL), 60, 300, &msg, "DISKCHECK", &DISKCHECK);
+  diskCheck->Depends("blockdevices");
+
+  /* create and add the jobs to the scheduler, a slow job must not hold up the rest */
   CScheduler s;
-  s.AddJob(new CMSGJob(midnight  , 86400, &msg, "FSCHECK"  , &FSCHECK  ));
-  s.AddJob(new CMSGJob(time(NULL), 60   , &msg, "DISKCHECK", &DISKCHECK));
+  if (!s.SetWorkers(4))
+    fprintf(stderr, "Failed to start the scheduler's workers, jobs will run in turn\n");
+
+  /*
+   * spread the fleet's jobs out by a splay fixed for this host plus some
+   * jitter, FSCHECK's must keep it within its shard's interval
+   */
+  s.SetSplayKey(msg.GetHostname());
+  s.AddJob(new CMSGJob(fsNext    , fsInterval, fsInterval, &msg, "FSCHECK"  , &FSCHECK  ), fsInterval * 500, 60000);
+  s.AddJob(diskCheck                                                                     , 60000           , 5000 );
+  s.AddJob(new CMSGJob(time(NULL), 5         , 60        , &msg, "FSEVENT"  , &FSEVENT  ), 5000            , 1000 );
+  s.AddJob(new CMSGJob(time(NULL), 300       , 60        , &msg, "METRICS"  , &METRICS  ), 300000          , 30000);
+  if (fsResume)
+    s.AddJob(new CMSGJob(time(NULL), 0         , fsInterval, &msg, "FSRESUME" , &FSRESUME , "FSCHECK"), 60000           , 0    );
+
+  CFSEventHandler  fsEvents;
+  std::vector<int> fsFDs;
+  FSMonitor.GetMonitorFDs(fsFDs);
+  for(std::vector<int>::iterator it = fsFDs.begin(); it != fsFDs.end(); ++it)
+    s.AddFD(*it, &fsEvents);
 
   while(true)
   {
     msg.Reset();
     if (s.Run())
     {
-      result = 0;
-      if (!msg.Send(result))
-        fprintf(stderr, "Failed to communicate with the ARMT server\n");
-      else if (result != 202)
-        fprintf(stderr, "Error in communication with the ARMT server, result = %d\n", result);
+      /* sent after FSCHECK with any files that differ from their package */
+      msg.AppendSegment("FSPKG", &FSPKG);
+
+      /* keep answering while the server descends into differing subtrees */
+      std::string reply;
+      for(unsigned int round = 0; round < 64; ++round)
+      {
+        result = 0;
+        if (!msg.Send(result, reply))
+        {
+          fprintf(stderr, "Failed to communicate with the ARMT server\n");
+          break;
+        }
+
+        if (result != 202)
+        {
+          fprintf(stderr, "Error in communication with the ARMT server, result = %d\n", result);
+          break;
+        }
+
+        if (!FSREQUESTS(reply))
+          break;
+
+        msg.Reset();
+        msg.AppendSegment("FSTREE", &FSTREE);
+        msg.AppendSegment("FSFULL", &FSFULL);
+      }
     }
-    sleep(1);
   }
 
   if (_hostent)
@@ -0,0 +1,155 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CBench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#include <vector>
+#include <algorithm>
+
+#define BENCH_PER_DIR 100
+
+double CBench::GetTime()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+bool CBench::MakeTree(const std::string &root, const unsigned int files, const unsigned int average, const bool shuffle/* = false */)
+{
+  char marker[64];
+  snprintf(marker, sizeof(marker), "%u %u %d\n", files, average, shuffle ? 1 : 0);
+
+  /* reuse the tree if it was made with the same layout, the marker sits
+   * beside the tree so it is not counted in it */
+  const std::string markerPath = root + ".bench";
+  FILE *fp = fopen(markerPath.c_str(), "r");
+  if (fp)
+  {
+    char line[64];
+    const bool same = fgets(line, sizeof(line), fp) && strcmp(line, marker) == 0;
+    fclose(fp);
+    if (same)
+      return true;
+
+    fprintf(stderr, "%s holds a different tree, remove it first\n", root.c_str());
+    return false;
+  }
+
+  if (mkdir(root.c_str(), 0755) < 0 && errno != EEXIST)
+    return false;
+
+  fprintf(stderr, "creating %u files in %s\n", files, root.c_str());
+  char path[PATH_MAX];
+  const unsigned int leaves = (files + BENCH_PER_DIR - 1) / BENCH_PER_DIR;
+  for(unsigned int leaf = 0; leaf < leaves; ++leaf)
+  {
+    if (leaf % BENCH_PER_DIR == 0)
+    {
+      snprintf(path, sizeof(path), "%s/%04u", root.c_str(), leaf / BENCH_PER_DIR);
+      mkdir(path, 0755);
+    }
+
+    snprintf(path, sizeof(path), "%s/%04u/%04u", root.c_str(), leaf / BENCH_PER_DIR, leaf % BENCH_PER_DIR);
+    mkdir(path, 0755);
+  }
+
+  /* a fixed seed so every run hashes the same content */
+  const size_t   max     = average * 2 + 1;
+  unsigned char *content = new unsigned char[max];
+  unsigned int   seed    = 1;
+  for(size_t i = 0; i < max; ++i)
+    content[i] = rand_r(&seed);
+
+  std::vector<unsigned int> order(files);
+  for(unsigned int i = 0; i < files; ++i)
+    order[i] = i;
+
+  if (shuffle)
+    for(unsigned int i = files; i > 1; --i)
+      std::swap(order[i - 1], order[rand_r(&seed) % i]);
+
+  bool ok = true;
+  for(unsigned int n = 0; ok && n < files; ++n)
+  {
+    const unsigned int i    = order[n];
+    const unsigned int leaf = i / BENCH_PER_DIR;
+    snprintf(path, sizeof(path), "%s/%04u/%04u/file%06u", root.c_str(), leaf / BENCH_PER_DIR, leaf % BENCH_PER_DIR, i);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+      ok = false;
+      break;
+    }
+
+    /* the size follows the file rather than the order it is written in,
+     * and the content varies too so no two files hash alike */
+    unsigned int fileSeed = i + 1;
+    const size_t size     = rand_r(&fileSeed) % max;
+    const size_t offset   = size ? i % (max - size + 1) : 0;
+    ok = write(fd, content + offset, size) == (ssize_t)size;
+    close(fd);
+  }
+
+  delete[] content;
+  if (!ok)
+    return false;
+
+  fp = fopen(markerPath.c_str(), "w");
+  if (!fp)
+    return false;
+
+  fputs(marker, fp);
+  fclose(fp);
+  return true;
+}
+
+bool CBench::DropCaches()
+{
+  sync();
+  int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+  if (fd < 0)
+    return false;
+
+  const bool ok = write(fd, "3", 1) == 1;
+  close(fd);
+  return ok;
+}
+
+uint64_t CBench::GetHeapUsed()
+{
+  /* mallinfo's int counters were replaced with size_t ones in glibc 2.33 */
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 info = mallinfo2();
+#else
+  struct mallinfo  info = mallinfo ();
+#endif
+  return (uint64_t)info.uordblks + (uint64_t)info.hblkhd;
+}
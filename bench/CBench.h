@@ -0,0 +1,65 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CBENCH_H_
+#define _CBENCH_H_
+
+#include <stdint.h>
+#include <string>
+
+/**
+  * Helpers shared by the benchmark programs in bench/, these are not
+  * linked into the agent
+  */
+class CBench
+{
+  public:
+    /**
+      * Returns a monotonic time in milliseconds
+      */
+    static double GetTime();
+
+    /**
+      * Create a synthetic tree of files if it does not already exist, the
+      * files are spread over directories of 100 with sizes uniformly
+      * distributed between 0 and twice the average. A marker beside the
+      * root records the layout so later runs reuse the tree.
+      * @param root    The directory to create the tree in
+      * @param files   The number of files
+      * @param average The average file size in bytes
+      * @param shuffle Write the files in a random order so their place on
+      *                disk has nothing to do with their names
+      * @return        False if the tree could not be created
+      */
+    static bool MakeTree(const std::string &root, const unsigned int files, const unsigned int average, const bool shuffle = false);
+
+    /**
+      * Write back and drop the page, dentry and inode caches, this needs root
+      * @return False if the caches could not be dropped
+      */
+    static bool DropCaches();
+
+    /**
+      * Returns the bytes of heap currently allocated
+      */
+    static uint64_t GetHeapUsed();
+};
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Compares the size of version 2 and version 3 baselines of a scanned tree
+ * along with the time to encode them with Save and decode them with
+ * CBaselineReader, from a stream and from a memory mapped file. The sizes
+ * are given raw and deflated as they are sent.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sstream>
+#include <fstream>
+
+#include "common/CCompress.h"
+#include "fs/CFSVerifier.h"
+#include "fs/CBaselineReader.h"
+#include "CBench.h"
+
+static void Usage(const char *name)
+{
+  fprintf(stderr,
+    "Usage: %s [-r runs] [directory]\n"
+    "  -r  runs of each, the best is reported, default 5\n"
+    "  the tree defaults to /usr\n",
+    name);
+}
+
+/* reads every record, returning the count or 0 on a malformed baseline */
+static uint64_t Decode(CBaselineReader &reader)
+{
+  uint64_t                records = 0;
+  CBaselineReader::Record record;
+  while(reader.Next(record))
+    ++records;
+
+  return reader.IsError() ? 0 : records;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned int runs = 5;
+
+  int opt;
+  while((opt = getopt(argc, argv, "r:")) != -1)
+    switch(opt)
+    {
+      case 'r': runs = strtoul(optarg, NULL, 10); break;
+      default:
+        Usage(argv[0]);
+        return -1;
+    }
+
+  const std::string root = optind < argc ? argv[optind] : "/usr";
+  if (runs == 0)
+  {
+    Usage(argv[0]);
+    return -1;
+  }
+
+  CFSVerifier verifier;
+  verifier.SetDropCache(false);
+  if (!verifier.AddPath(root, true))
+  {
+    fprintf(stderr, "failed to add %s\n", root.c_str());
+    return -1;
+  }
+
+  fprintf(stderr, "scanning %s\n", root.c_str());
+  verifier.Scan();
+
+  char file[] = "/tmp/armt-bench-baseline.XXXXXX";
+  int  fd     = mkstemp(file);
+  if (fd < 0)
+    return -1;
+  close(fd);
+
+  printf("%-8s %10s %12s %12s %10s %12s %12s\n",
+    "version", "records", "bytes", "deflated", "save ms", "stream ms", "mapped ms");
+
+  int result = 0;
+  for(unsigned int version = 2; version <= 3; ++version)
+  {
+    std::string baseline;
+    double      save = 0;
+    for(unsigned int run = 0; run < runs; ++run)
+    {
+      std::stringstream ss;
+      const double start = CBench::GetTime();
+      verifier.Save(ss, version);
+      const double ms = CBench::GetTime() - start;
+      if (run == 0 || ms < save)
+        save = ms;
+
+      baseline = ss.str();
+    }
+
+    std::istringstream raw(baseline);
+    std::ostringstream deflated;
+    CCompress::Deflate(raw, deflated);
+
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    out.write(baseline.data(), baseline.size());
+    out.close();
+
+    uint64_t records = 0;
+    double   stream  = 0, mapped = 0;
+    for(unsigned int run = 0; run < runs; ++run)
+    {
+      std::istringstream input(baseline);
+      CBaselineReader    streamReader;
+      double start = CBench::GetTime();
+      if (streamReader.Open(input))
+        records = Decode(streamReader);
+      double ms = CBench::GetTime() - start;
+      if (run == 0 || ms < stream)
+        stream = ms;
+
+      CBaselineReader mapReader;
+      start = CBench::GetTime();
+      if (!mapReader.Open(std::string(file)) || Decode(mapReader) != records)
+        records = 0;
+      ms = CBench::GetTime() - start;
+      if (run == 0 || ms < mapped)
+        mapped = ms;
+    }
+
+    if (records == 0)
+    {
+      fprintf(stderr, "failed to decode the version %u baseline\n", version);
+      result = -1;
+    }
+
+    printf("%-8u %10llu %12lu %12lu %10.1f %12.1f %12.1f\n",
+      version,
+      (unsigned long long)records,
+      (unsigned long)baseline.size(),
+      (unsigned long)deflated.str().size(),
+      save,
+      stream,
+      mapped);
+  }
+
+  unlink(file);
+  return result;
+}
@@ -0,0 +1,179 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Compares the heap used by CFileIndex with the std::map of path strings
+ * and new[] digests that CFSVerifier used before it. The paths are either
+ * synthetic, laid out as bench/scan's tree is, or taken from a real tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <map>
+#include <vector>
+#include <string>
+
+#include "fs/CFileIndex.h"
+#include "CBench.h"
+
+#define INDEX_DIGEST_LEN 16
+
+/* the layout CFSVerifier used before CFileIndex */
+typedef std::map<std::string, unsigned char *> FileMap;
+
+struct PathEntry
+{
+  std::string m_dir;
+  std::string m_name;
+};
+
+typedef std::vector<PathEntry> PathList;
+
+static PathList *s_walkPaths = NULL;
+
+static int WalkCallback(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+  if (flag != FTW_F || !S_ISREG(st->st_mode))
+    return 0;
+
+  PathEntry entry;
+  entry.m_dir .assign(path, ftw->base - 1);
+  entry.m_name.assign(path + ftw->base);
+  s_walkPaths->push_back(entry);
+  return 0;
+}
+
+static void Usage(const char *name)
+{
+  fprintf(stderr,
+    "Usage: %s [-f files] [-d directory]\n"
+    "  -f  synthetic files to index, default 200000\n"
+    "  -d  index the files of a real tree instead\n",
+    name);
+}
+
+static void Report(const char *name, const size_t files, const uint64_t bytes, const double ms)
+{
+  printf("%-10s %10lu %12.1f %10.1f %10.1f\n",
+    name,
+    (unsigned long)files,
+    bytes / (1024.0 * 1024.0),
+    files ? (double)bytes / files : 0.0,
+    ms);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned int files = 200000;
+  std::string  root;
+
+  int opt;
+  while((opt = getopt(argc, argv, "f:d:")) != -1)
+    switch(opt)
+    {
+      case 'f': files = strtoul(optarg, NULL, 10); break;
+      case 'd': root  = optarg;                    break;
+      default:
+        Usage(argv[0]);
+        return -1;
+    }
+
+  PathList paths;
+  if (root.empty())
+  {
+    char dir[64], name[32];
+    paths.reserve(files);
+    for(unsigned int i = 0; i < files; ++i)
+    {
+      const unsigned int leaf = i / 100;
+      snprintf(dir , sizeof(dir ), "/var/lib/armt-bench/%04u/%04u", leaf / 100, leaf % 100);
+      snprintf(name, sizeof(name), "file%06u", i);
+
+      PathEntry entry;
+      entry.m_dir  = dir;
+      entry.m_name = name;
+      paths.push_back(entry);
+    }
+  }
+  else
+  {
+    s_walkPaths = &paths;
+    if (nftw(root.c_str(), WalkCallback, 64, FTW_PHYS) != 0)
+    {
+      fprintf(stderr, "failed to walk %s\n", root.c_str());
+      return -1;
+    }
+  }
+
+  unsigned char digest[INDEX_DIGEST_LEN];
+  memset(digest, 0xAA, sizeof(digest));
+
+  printf("%-10s %10s %12s %10s %10s\n", "layout", "files", "heap MB", "B/file", "build ms");
+
+  /* the old layout, one heap string per path and one digest allocation */
+  {
+    const uint64_t before = CBench::GetHeapUsed();
+    const double   start  = CBench::GetTime();
+
+    FileMap map;
+    for(PathList::const_iterator it = paths.begin(); it != paths.end(); ++it)
+    {
+      unsigned char *copy = new unsigned char[INDEX_DIGEST_LEN];
+      memcpy(copy, digest, INDEX_DIGEST_LEN);
+      map[it->m_dir + "/" + it->m_name] = copy;
+    }
+
+    const double   ms   = CBench::GetTime() - start;
+    const uint64_t used = CBench::GetHeapUsed() - before;
+    Report("std::map", map.size(), used, ms);
+
+    for(FileMap::iterator it = map.begin(); it != map.end(); ++it)
+      delete[] it->second;
+  }
+
+  /* the arena index, interning each directory once as Walk does */
+  {
+    const uint64_t before = CBench::GetHeapUsed();
+    const double   start  = CBench::GetTime();
+
+    CFileIndex index(INDEX_DIGEST_LEN);
+    const std::string *lastDir = NULL;
+    uint32_t           dirID   = 0;
+    for(PathList::const_iterator it = paths.begin(); it != paths.end(); ++it)
+    {
+      if (!lastDir || *lastDir != it->m_dir)
+      {
+        dirID   = index.AddDir(it->m_dir);
+        lastDir = &it->m_dir;
+      }
+      index.Add(dirID, it->m_name.data(), it->m_name.length(), digest);
+    }
+    index.Sort();
+
+    const double   ms   = CBench::GetTime() - start;
+    const uint64_t used = CBench::GetHeapUsed() - before;
+    Report("CFileIndex", index.Size(), used, ms);
+  }
+
+  return 0;
+}
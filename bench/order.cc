@@ -0,0 +1,200 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Compares the cold cache Scan time of each hash order. The files are
+ * written in a random order so neither their names nor the order the walk
+ * finds them in has anything to do with where they are on disk, as happens
+ * to a tree that has been updated over the years.
+ *
+ * Point it at a directory on the disk to measure, or give it an image file
+ * on that disk with -i and it is formatted ext4 and loop mounted. It needs
+ * root to drop the caches and mount the image.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fs/CFSVerifier.h"
+#include "CBench.h"
+
+static void Usage(const char *name)
+{
+  fprintf(stderr,
+    "Usage: %s [-f files] [-s average size] [-t threads] [-r runs] [-i image [-m MB]] [directory]\n"
+    "  -f  files in the tree, default 20000\n"
+    "  -s  average file size in bytes, default 32768\n"
+    "  -t  hashing threads, default 1\n"
+    "  -r  runs of each order, the best is reported, default 3\n"
+    "  -i  an image file to create if needed and loop mount\n"
+    "  -m  the size of a new image in MiB, default 2048\n",
+    name);
+}
+
+static bool Run(const std::string &cmd)
+{
+  if (system(cmd.c_str()) != 0)
+  {
+    fprintf(stderr, "failed: %s\n", cmd.c_str());
+    return false;
+  }
+  return true;
+}
+
+static bool MountImage(const std::string &image, const unsigned int mb, const std::string &mount)
+{
+  struct stat st;
+  if (stat(image.c_str(), &st) < 0)
+  {
+    int fd = open(image.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+      return false;
+
+    const bool ok = ftruncate(fd, (off_t)mb * 1024 * 1024) == 0;
+    close(fd);
+    if (!ok || !Run("mkfs.ext4 -q -F '" + image + "'"))
+    {
+      unlink(image.c_str());
+      return false;
+    }
+  }
+
+  return Run("mount -o loop '" + image + "' '" + mount + "'");
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned int files   = 20000;
+  unsigned int average = 32768;
+  unsigned int threads = 1;
+  unsigned int runs    = 3;
+  unsigned int mb      = 2048;
+  std::string  image;
+
+  int opt;
+  while((opt = getopt(argc, argv, "f:s:t:r:i:m:")) != -1)
+    switch(opt)
+    {
+      case 'f': files   = strtoul(optarg, NULL, 10); break;
+      case 's': average = strtoul(optarg, NULL, 10); break;
+      case 't': threads = strtoul(optarg, NULL, 10); break;
+      case 'r': runs    = strtoul(optarg, NULL, 10); break;
+      case 'i': image   = optarg;                    break;
+      case 'm': mb      = strtoul(optarg, NULL, 10); break;
+      default:
+        Usage(argv[0]);
+        return -1;
+    }
+
+  if (threads == 0 || runs == 0)
+  {
+    Usage(argv[0]);
+    return -1;
+  }
+
+  std::string root = optind < argc ? argv[optind] : "/tmp/armt-bench-order";
+  std::string mount;
+  if (!image.empty())
+  {
+    char tmp[] = "/tmp/armt-bench-mnt.XXXXXX";
+    if (!mkdtemp(tmp))
+      return -1;
+
+    mount = tmp;
+    if (!MountImage(image, mb, mount))
+    {
+      rmdir(mount.c_str());
+      return -1;
+    }
+
+    /* the tree and its marker live in the image */
+    root = mount + "/tree";
+  }
+
+  int result = 0;
+  if (!CBench::MakeTree(root, files, average, true))
+    result = -1;
+  else if (!CBench::DropCaches())
+  {
+    fprintf(stderr, "failed to drop the caches, this needs root\n");
+    result = -1;
+  }
+  else
+  {
+    static const struct
+    {
+      CFSVerifier::Order m_order;
+      const char        *m_name;
+    }
+    orders[] =
+    {
+      { CFSVerifier::ORDER_NONE  , "walk"   },
+      { CFSVerifier::ORDER_INODE , "inode"  },
+      { CFSVerifier::ORDER_EXTENT, "extent" }
+    };
+
+    printf("%-8s %10s %10s %10s %10s %12s %10s\n", "order", "files", "extents", "MB", "seconds", "ordering ms", "MB/s");
+    for(size_t o = 0; o < sizeof(orders) / sizeof(orders[0]); ++o)
+    {
+      double                 best = 0;
+      CFSVerifier::ScanStats stats;
+      for(unsigned int run = 0; run < runs; ++run)
+      {
+        CBench::DropCaches();
+
+        CFSVerifier verifier;
+        verifier.SetThreads(threads);
+        verifier.SetOrder  (orders[o].m_order);
+        verifier.AddPath(root, true);
+
+        const double start = CBench::GetTime();
+        verifier.Scan();
+        const double ms = CBench::GetTime() - start;
+        if (run == 0 || ms < best)
+        {
+          best  = ms;
+          stats = verifier.GetStats();
+        }
+      }
+
+      const double size = stats.m_bytes / (1024.0 * 1024.0);
+      printf("%-8s %10llu %10llu %10.1f %10.2f %12llu %10.1f\n",
+        orders[o].m_name,
+        (unsigned long long)stats.m_files,
+        (unsigned long long)stats.m_extents,
+        size,
+        best / 1000.0,
+        (unsigned long long)stats.m_ordering,
+        size / (best / 1000.0));
+    }
+  }
+
+  if (!mount.empty())
+  {
+    Run("umount '" + mount + "'");
+    rmdir(mount.c_str());
+  }
+
+  return result;
+}
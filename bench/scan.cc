@@ -0,0 +1,112 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Measures the throughput of CFSVerifier::Scan over a synthetic tree at
+ * each thread count from 1 to N. By default the tree is warm in the page
+ * cache, -c drops the caches before each run to measure the disk instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fs/CFSVerifier.h"
+#include "CBench.h"
+
+static void Usage(const char *name)
+{
+  fprintf(stderr,
+    "Usage: %s [-f files] [-s average size] [-t max threads] [-c] [directory]\n"
+    "  -f  files in the tree, default 200000\n"
+    "  -s  average file size in bytes, default 4096\n"
+    "  -t  highest thread count to run, default the online CPUs\n"
+    "  -c  drop the caches before each run, needs root\n",
+    name);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned int files   = 200000;
+  unsigned int average = 4096;
+  unsigned int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  bool         cold    = false;
+
+  int opt;
+  while((opt = getopt(argc, argv, "f:s:t:c")) != -1)
+    switch(opt)
+    {
+      case 'f': files   = strtoul(optarg, NULL, 10); break;
+      case 's': average = strtoul(optarg, NULL, 10); break;
+      case 't': threads = strtoul(optarg, NULL, 10); break;
+      case 'c': cold    = true;                      break;
+      default:
+        Usage(argv[0]);
+        return -1;
+    }
+
+  const std::string root = optind < argc ? argv[optind] : "/tmp/armt-bench-scan";
+  if (threads == 0 || !CBench::MakeTree(root, files, average))
+  {
+    Usage(argv[0]);
+    return -1;
+  }
+
+  /* one untimed pass so the warm runs all start from the same state */
+  if (!cold)
+  {
+    CFSVerifier warm;
+    warm.SetThreads (threads);
+    warm.SetDropCache(false);
+    warm.AddPath(root, true);
+    warm.Scan();
+  }
+
+  printf("%-8s %10s %10s %10s %12s %10s\n", "threads", "files", "MB", "seconds", "files/s", "MB/s");
+  for(unsigned int t = 1; t <= threads; ++t)
+  {
+    if (cold && !CBench::DropCaches())
+    {
+      fprintf(stderr, "failed to drop the caches, -c needs root\n");
+      return -1;
+    }
+
+    CFSVerifier verifier;
+    verifier.SetThreads  (t);
+    verifier.SetDropCache(cold);
+    verifier.AddPath(root, true);
+
+    const double start = CBench::GetTime();
+    verifier.Scan();
+    const double seconds = (CBench::GetTime() - start) / 1000.0;
+
+    const CFSVerifier::ScanStats &stats = verifier.GetStats();
+    const double mb = stats.m_bytes / (1024.0 * 1024.0);
+    printf("%-8u %10llu %10.1f %10.2f %12.0f %10.1f\n",
+      t,
+      (unsigned long long)stats.m_files,
+      mb,
+      seconds,
+      stats.m_files / seconds,
+      mb / seconds);
+  }
+
+  return 0;
+}
@@ -0,0 +1,291 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Compares CFSVerifier's single pass getdents64 walk with the walk it
+ * replaced, where AddPath found every directory with opendir and realpath
+ * and Scan then reopened each one and lstat'd every entry. Both hand the
+ * files they find to one hashing thread so the difference is in the walk,
+ * small files keep the hashing from hiding it. Each is run with a warm cache and,
+ * as root, after dropping the caches.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
+
+#include "common/CWorkQueue.h"
+#include "fs/CFSVerifier.h"
+#include "CBench.h"
+
+/* as CFSVerifier sizes its queue for one thread */
+#define LEGACY_QUEUE_DEPTH 64
+
+/* the walk CFSVerifier used before CDirReader, without the path matcher */
+class CLegacyWalk
+{
+  public:
+    CLegacyWalk() :
+      m_hasher(IHashEngine::HT_MD5),
+      m_queue (NULL),
+      m_files (0   ),
+      m_stat  (0   )
+    {
+      m_hasher.SetDropCache(false);
+    }
+
+    bool AddPath(const std::string &path)
+    {
+      struct stat st;
+      ++m_stat;
+      if (stat(path.c_str(), &st) < 0 || !S_ISDIR(st.st_mode))
+        return false;
+
+      char *resolved = realpath(path.c_str(), NULL);
+      if (!resolved)
+        return false;
+
+      const std::string real(resolved);
+      free(resolved);
+      return AddDir(real);
+    }
+
+    uint64_t Scan()
+    {
+      PathQueue queue(LEGACY_QUEUE_DEPTH);
+      m_queue = &queue;
+      m_files = 0;
+
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, HashThread, this) != 0)
+        return 0;
+
+      for(PathMap::iterator it = m_paths.begin(); it != m_paths.end(); ++it)
+      {
+        DIR *dh = opendir(it->first.c_str());
+        if (!dh)
+          continue;
+
+        while(struct dirent *dir = readdir(dh))
+        {
+          if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0)
+            continue;
+
+          std::string path = it->first;
+          path.append("/");
+          path.append(dir->d_name);
+
+          struct stat st;
+          ++m_stat;
+          if (lstat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+            continue;
+
+          queue.Push(path);
+        }
+        closedir(dh);
+      }
+
+      queue.Close();
+      pthread_join(thread, NULL);
+      return m_files;
+    }
+
+    uint64_t GetStatCalls() { return m_stat; }
+    uint64_t GetDirs     () { return m_paths.size(); }
+
+  private:
+    typedef std::map<std::string, bool> PathMap;
+    typedef CWorkQueue<std::string>     PathQueue;
+
+    CFileHasher m_hasher;
+    PathMap     m_paths;
+    PathQueue  *m_queue;
+    uint64_t    m_files;
+    uint64_t    m_stat;
+
+    static void *HashThread(void *arg)
+    {
+      CLegacyWalk  *walk = (CLegacyWalk *)arg;
+      std::string   path;
+      unsigned char digest[HASH_MAX_DIGEST];
+      while(walk->m_queue->Pop(path))
+        if (walk->m_hasher.HashFile(path, digest))
+          ++walk->m_files;
+
+      return NULL;
+    }
+
+    bool AddDir(const std::string &path)
+    {
+      if (!m_paths.insert(std::make_pair(path, true)).second)
+        return false;
+
+      DIR *dh = opendir(path.c_str());
+      if (!dh)
+        return true;
+
+      while(struct dirent *dir = readdir(dh))
+      {
+        if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0)
+          continue;
+
+        if (dir->d_type != DT_DIR && dir->d_type != DT_LNK && dir->d_type != DT_UNKNOWN)
+          continue;
+
+        std::string next = path;
+        next.append("/");
+        next.append(dir->d_name);
+
+        /* only links need resolving, anything else below a realpath is real */
+        if (dir->d_type != DT_DIR)
+        {
+          struct stat st;
+          ++m_stat;
+          if (stat(next.c_str(), &st) < 0 || !S_ISDIR(st.st_mode))
+            continue;
+
+          ++m_stat;
+          if (dir->d_type == DT_LNK || lstat(next.c_str(), &st) < 0 || S_ISLNK(st.st_mode))
+          {
+            char *resolved = realpath(next.c_str(), NULL);
+            if (!resolved)
+              continue;
+            next.assign(resolved);
+            free(resolved);
+          }
+        }
+
+        AddDir(next);
+      }
+      closedir(dh);
+
+      return true;
+    }
+};
+
+static void Usage(const char *name)
+{
+  fprintf(stderr,
+    "Usage: %s [-f files] [-s average size] [-r runs] [directory]\n"
+    "  -f  files in the tree, default 200000\n"
+    "  -s  average file size in bytes, default 512\n"
+    "  -r  runs of each, the best is reported, default 3\n",
+    name);
+}
+
+static void Report(const char *cache, const char *walk, const uint64_t files,
+  const uint64_t dirs, const uint64_t stats, const double ms)
+{
+  printf("%-6s %-8s %10llu %8llu %10llu %10.2f %12.0f\n",
+    cache,
+    walk,
+    (unsigned long long)files,
+    (unsigned long long)dirs,
+    (unsigned long long)stats,
+    ms / 1000.0,
+    files / (ms / 1000.0));
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned int files   = 200000;
+  unsigned int average = 512;
+  unsigned int runs    = 3;
+
+  int opt;
+  while((opt = getopt(argc, argv, "f:s:r:")) != -1)
+    switch(opt)
+    {
+      case 'f': files   = strtoul(optarg, NULL, 10); break;
+      case 's': average = strtoul(optarg, NULL, 10); break;
+      case 'r': runs    = strtoul(optarg, NULL, 10); break;
+      default:
+        Usage(argv[0]);
+        return -1;
+    }
+
+  const std::string root = optind < argc ? argv[optind] : "/tmp/armt-bench-walk";
+  if (runs == 0 || !CBench::MakeTree(root, files, average))
+  {
+    Usage(argv[0]);
+    return -1;
+  }
+
+  const bool canDrop = CBench::DropCaches();
+  if (!canDrop)
+    fprintf(stderr, "not root, skipping the cold cache runs\n");
+
+  printf("%-6s %-8s %10s %8s %10s %10s %12s\n", "cache", "walk", "files", "dirs", "stats", "seconds", "files/s");
+  for(int cold = canDrop ? 1 : 0; cold >= 0; --cold)
+  {
+    const char *cache = cold ? "cold" : "warm";
+
+    /* the page cache is dropped before each run or warmed by the last */
+    double   best   = 0;
+    uint64_t found  = 0, dirs = 0, stats = 0;
+    for(unsigned int run = 0; run < runs; ++run)
+    {
+      if (cold)
+        CBench::DropCaches();
+
+      CLegacyWalk legacy;
+      const double start = CBench::GetTime();
+      legacy.AddPath(root);
+      found = legacy.Scan();
+      const double ms = CBench::GetTime() - start;
+      if (run == 0 || ms < best)
+        best = ms;
+
+      dirs  = legacy.GetDirs();
+      stats = legacy.GetStatCalls();
+    }
+    Report(cache, "readdir", found, dirs, stats, best);
+
+    for(unsigned int run = 0; run < runs; ++run)
+    {
+      if (cold)
+        CBench::DropCaches();
+
+      CFSVerifier verifier;
+      verifier.SetThreads  (1);
+      verifier.SetDropCache(false);
+
+      const double start = CBench::GetTime();
+      verifier.AddPath(root, true);
+      verifier.Scan();
+      const double ms = CBench::GetTime() - start;
+      if (run == 0 || ms < best)
+        best = ms;
+
+      const CFSVerifier::ScanStats &s = verifier.GetStats();
+      found = s.m_files;
+      dirs  = s.m_dirs;
+      stats = s.m_stat;
+    }
+    Report(cache, "getdents", found, dirs, stats, best);
+  }
+
+  return 0;
+}
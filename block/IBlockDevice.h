@@ -33,6 +33,8 @@ class IBlockDevice
     typedef std::map <std::string, IBlockDevice *> Map;
     typedef std::pair<std::string, IBlockDevice *> MapPair;
 
+    virtual ~IBlockDevice() {}
+
     /**
       * Returns the block device type (eg, IBlockDevice)
       */
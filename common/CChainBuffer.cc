@@ -0,0 +1,112 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CChainBuffer.h"
+
+#include <string.h>
+
+CChainBuffer::CChainBuffer(const size_t blockSize/* = 65536 */, const size_t keep/* = 16 */) :
+  m_used     (0                            ),
+  m_blockSize(blockSize > 0 ? blockSize : 1),
+  m_keep     (keep                         )
+{
+  setp(NULL, NULL);
+}
+
+CChainBuffer::~CChainBuffer()
+{
+  for(BlockList::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it)
+    delete[] *it;
+}
+
+void CChainBuffer::Reset()
+{
+  while(m_blocks.size() > m_keep)
+  {
+    delete[] m_blocks.back();
+    m_blocks.pop_back();
+  }
+
+  m_used = 0;
+  setp(NULL, NULL);
+}
+
+size_t CChainBuffer::GetLength() const
+{
+  if (m_used == 0)
+    return 0;
+  return (m_used - 1) * m_blockSize + (pptr() - pbase());
+}
+
+const char *CChainBuffer::GetBlock(const size_t index, size_t &length) const
+{
+  length = index + 1 < m_used ? m_blockSize : pptr() - pbase();
+  return m_blocks[index];
+}
+
+bool CChainBuffer::NextBlock()
+{
+  if (m_used == m_blocks.size())
+    m_blocks.push_back(new char[m_blockSize]);
+
+  char *block = m_blocks[m_used++];
+  setp(block, block + m_blockSize);
+  return true;
+}
+
+CChainBuffer::int_type CChainBuffer::overflow(int_type c)
+{
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+
+  if (pptr() == epptr() && !NextBlock())
+    return traits_type::eof();
+
+  *pptr() = traits_type::to_char_type(c);
+  pbump(1);
+  return c;
+}
+
+std::streamsize CChainBuffer::xsputn(const char *s, std::streamsize n)
+{
+  std::streamsize done = 0;
+  while(done < n)
+  {
+    if (pptr() == epptr() && !NextBlock())
+      break;
+
+    std::streamsize len = epptr() - pptr();
+    if (len > n - done)
+      len = n - done;
+
+    memcpy(pptr(), s + done, len);
+    pbump(len);
+    done += len;
+  }
+  return done;
+}
+
+CChainBuffer::pos_type CChainBuffer::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+  /* only tellp is supported, the data can not be rewritten */
+  if (off != 0 || dir != std::ios_base::cur || !(which & std::ios_base::out))
+    return pos_type(off_type(-1));
+  return pos_type(GetLength());
+}
@@ -0,0 +1,82 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CCHAINBUFFER_H_
+#define _CCHAINBUFFER_H_
+
+#include <streambuf>
+#include <vector>
+
+/**
+  * A write only stream buffer kept in a chain of fixed size blocks, so
+  * growing it never copies what has already been written.
+  *
+  * Reset empties it but keeps a few blocks, so a buffer that is reused
+  * does not allocate again for data of a similar size.
+  */
+class CChainBuffer : public std::streambuf
+{
+  public:
+    /**
+      * @param blockSize The bytes in each block
+      * @param keep      The most blocks Reset keeps for reuse
+      */
+    CChainBuffer(const size_t blockSize = 65536, const size_t keep = 16);
+    ~CChainBuffer();
+
+    /**
+      * Empty the buffer, keeping up to the limit of blocks for reuse
+      */
+    void Reset();
+
+    /**
+      * Returns the bytes written
+      */
+    size_t GetLength() const;
+
+    /**
+      * Returns the number of blocks holding data
+      */
+    size_t GetBlockCount() const { return m_used; }
+
+    /**
+      * Returns a block of the data, in order
+      * @param index  The block, less than GetBlockCount
+      * @param length Receives the bytes held by the block
+      */
+    const char *GetBlock(const size_t index, size_t &length) const;
+
+  protected:
+    virtual int_type        overflow(int_type c);
+    virtual std::streamsize xsputn  (const char *s, std::streamsize n);
+    virtual pos_type        seekoff (off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which);
+
+  private:
+    typedef std::vector<char *> BlockList;
+
+    BlockList m_blocks;
+    size_t    m_used;      /* blocks holding data, the last is the put area */
+    size_t    m_blockSize;
+    size_t    m_keep;
+
+    bool NextBlock();
+};
+
+#endif // _CCHAINBUFFER_H_
@@ -39,6 +39,7 @@
 #include <locale>
 
 #include "CDNS.h"
+#include "CGovernor.h"
 
 #include "../utils/cciss_vol_status.h"
 #include "../utils/smartctl.h"
@@ -51,6 +52,7 @@ std::string      CCommon::m_exePath;
 std::string      CCommon::m_basePath;
 entropy_context  CCommon::m_entropy;
 ctr_drbg_context CCommon::m_drbg;
+CGovernor       *CCommon::m_governor = NULL;
 
 bool __attribute__((optimize("O0"))) detectBE()
 {
@@ -341,6 +343,10 @@ bool CCommon::RunCommand(std::string &result, const std::string &cmd, ...)
       dup2(pipefd[1], 2);
       close(pipefd[1]);
 
+      /* the priority is inherited by the command across execve */
+      if (m_governor)
+        m_governor->Apply();
+
       /* count the arguments */
       int argc = 0;
       va_list vl;
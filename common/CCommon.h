@@ -28,6 +28,8 @@
 #include "polarssl/entropy.h"
 #include "polarssl/ctr_drbg.h"
 
+class CGovernor;
+
 class CCommon
 {
   public:
@@ -60,6 +62,11 @@ class CCommon
     static bool SimpleReadUInt16(const std::string &path, uint16_t    &dest, const int base = 10);
 
     static bool RunCommand(std::string &result, const std::string &cmd, ...) __attribute__ ((sentinel));
+
+    /**
+      * Apply a governor's priority and affinity to commands started by RunCommand
+      */
+    static void SetCommandGovernor(CGovernor *governor) { m_governor = governor; }
   private:
     static bool             m_isBE;
     static std::string      m_exePath;
@@ -67,6 +74,7 @@ class CCommon
 
     static entropy_context  m_entropy;
     static ctr_drbg_context m_drbg;
+    static CGovernor       *m_governor;
 };
 
 #endif // _CCOMMON_H_
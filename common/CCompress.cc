@@ -23,59 +23,46 @@
 #include <stdio.h>
 #include "zlib.h"
 
-bool CCompress::Deflate(std::istream &input, std::ostream &output, bool gzip/* = false */)
+/* the size of the blocks CDeflater passes to its sink */
+#define DEFLATE_BLOCK 65536
+
+/* collects a CDeflater's output in a stream */
+class COStreamSink : public IDeflateSink
 {
-  if (!input.good() || !output.good())
-    return false;
+  public:
+    COStreamSink(std::ostream &output) : m_output(output) {}
 
-  z_stream strm;
-  strm.zalloc = Z_NULL;
-  strm.zfree  = Z_NULL;
-  strm.opaque = Z_NULL;
+    virtual bool Write(const char *data, const size_t length)
+    {
+      m_output.write(data, length);
+      return m_output.good();
+    }
 
-  int ret, flush;
+  private:
+    std::ostream &m_output;
+};
 
-  ret = deflateInit2(
-    &strm,
-    Z_BEST_COMPRESSION,
-    Z_DEFLATED,
-    gzip ? (16 + MAX_WBITS) : MAX_WBITS,
-    MAX_MEM_LEVEL,
-    Z_DEFAULT_STRATEGY
-  );
-  if (ret != Z_OK)
+bool CCompress::Deflate(std::istream &input, std::ostream &output, bool gzip/* = false */)
+{
+  if (!input.good() || !output.good())
     return false;
 
+  COStreamSink sink(output);
+  CDeflater    deflater(&sink, gzip);
+
   /* seek to the start of the stream */
   input.seekg(0);
 
+  char bin[65535];
   do
   {
-    char bin [65535];
-    char bout[65535];
-
-    /* fill the buffer */
     input.read(bin, sizeof(bin));
-    strm.avail_in = input.gcount();
-    strm.next_in  = (unsigned char *)bin;
-    flush = input.eof() ? Z_FINISH : Z_NO_FLUSH;
-
-    /* deflate the data and append it */
-    do
-    {
-      strm.avail_out = sizeof(bout);
-      strm.next_out  = (unsigned char *)bout;
-
-      ret = deflate(&strm, flush);
-      output.write(bout, sizeof(bout) - strm.avail_out);
-    }
-    while (strm.avail_out == 0);
-
+    if (!deflater.Write(bin, input.gcount()))
+      return false;
   }
-  while (flush != Z_FINISH);
+  while(!input.eof());
 
-  deflateEnd(&strm);
-  return true;
+  return deflater.Finish();
 }
 
 bool CCompress::Inflate(std::istream &input, std::ostream &output, bool gzip/* = false */)
@@ -140,3 +127,70 @@ bool CCompress::Inflate(std::istream &input, std::ostream &output, bool gzip/* =
   inflateEnd(&strm);
   return true;
 }
+
+CDeflater::CDeflater(IDeflateSink *sink, const bool gzip/* = false */) :
+  m_strm(new z_stream),
+  m_sink(sink),
+  m_out (new char[DEFLATE_BLOCK])
+{
+  m_strm->zalloc = Z_NULL;
+  m_strm->zfree  = Z_NULL;
+  m_strm->opaque = Z_NULL;
+
+  m_ok = deflateInit2(
+    m_strm,
+    Z_BEST_COMPRESSION,
+    Z_DEFLATED,
+    gzip ? (16 + MAX_WBITS) : MAX_WBITS,
+    MAX_MEM_LEVEL,
+    Z_DEFAULT_STRATEGY
+  ) == Z_OK;
+}
+
+CDeflater::~CDeflater()
+{
+  deflateEnd(m_strm);
+  delete   m_strm;
+  delete[] m_out;
+}
+
+bool CDeflater::Deflate(const int flush)
+{
+  /* deflate until the output is not filled, passing each block on */
+  do
+  {
+    m_strm->avail_out = DEFLATE_BLOCK;
+    m_strm->next_out  = (unsigned char *)m_out;
+
+    const int ret = deflate(m_strm, flush);
+    if (ret == Z_STREAM_ERROR)
+      return m_ok = false;
+
+    const size_t length = DEFLATE_BLOCK - m_strm->avail_out;
+    if (length > 0 && !m_sink->Write(m_out, length))
+      return m_ok = false;
+  }
+  while(m_strm->avail_out == 0);
+
+  return true;
+}
+
+bool CDeflater::Write(const char *data, const size_t length)
+{
+  if (!m_ok)
+    return false;
+
+  m_strm->avail_in = length;
+  m_strm->next_in  = (unsigned char *)data;
+  return Deflate(Z_NO_FLUSH);
+}
+
+bool CDeflater::Finish()
+{
+  if (!m_ok)
+    return false;
+
+  m_strm->avail_in = 0;
+  m_strm->next_in  = Z_NULL;
+  return Deflate(Z_FINISH);
+}
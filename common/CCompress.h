@@ -21,9 +21,12 @@
 #ifndef _CCOMPRESS_H_
 #define _CCOMPRESS_H_
 
+#include <stddef.h>
 #include <istream>
 #include <ostream>
 
+struct z_stream_s;
+
 class CCompress
 {
   public:
@@ -31,4 +34,48 @@ class CCompress
     static bool Inflate(std::istream &input, std::ostream &output, bool gzip = false);
 };
 
+/**
+  * Receives the output of a CDeflater as it is produced
+  */
+class IDeflateSink
+{
+  public:
+    IDeflateSink() {}
+    virtual ~IDeflateSink() {}
+
+    /**
+      * @return False to stop the deflater
+      */
+    virtual bool Write(const char *data, const size_t length) = 0;
+};
+
+/**
+  * Deflates data as it is written, passing the output to a sink a block
+  * at a time so neither the input nor the output is held in memory
+  */
+class CDeflater
+{
+  public:
+    CDeflater(IDeflateSink *sink, const bool gzip = false);
+    ~CDeflater();
+
+    /**
+      * @return False if the deflater failed or the sink refused the output
+      */
+    bool Write(const char *data, const size_t length);
+
+    /**
+      * Flush the rest of the output and end the stream
+      */
+    bool Finish();
+
+  private:
+    struct z_stream_s *m_strm;
+    IDeflateSink      *m_sink;
+    char              *m_out;
+    bool               m_ok;
+
+    bool Deflate(const int flush);
+};
+
 #endif // _CCOMPRESS_H_
@@ -0,0 +1,156 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CDataCache.h"
+#include "CMetrics.h"
+
+#include <time.h>
+#include <algorithm>
+
+/* static declarations */
+pthread_mutex_t       CDataCache::m_lock = PTHREAD_MUTEX_INITIALIZER;
+CDataCache::SourceMap CDataCache::m_sources;
+
+uint64_t CDataCache::GetTime()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void CDataCache::Register(const std::string &name, IDataSource *source, const unsigned int ttl)
+{
+  pthread_mutex_lock(&m_lock);
+  SourceMap::iterator it = m_sources.find(name);
+  if (it != m_sources.end())
+  {
+    /* replacing a source, its snapshot belongs to the old one */
+    pthread_rwlock_wrlock(&it->second->m_lock);
+    it->second->m_source = source;
+    it->second->m_ttl    = ttl;
+    it->second->m_valid  = false;
+    pthread_rwlock_unlock(&it->second->m_lock);
+    pthread_mutex_unlock(&m_lock);
+    return;
+  }
+
+  Source *entry = new Source();
+  entry->m_source    = source;
+  entry->m_ttl       = ttl;
+  entry->m_refreshed = 0;
+  entry->m_valid     = false;
+  pthread_rwlock_init(&entry->m_lock, NULL);
+  m_sources[name] = entry;
+  pthread_mutex_unlock(&m_lock);
+}
+
+CDataCache::Source *CDataCache::Find(const std::string &name)
+{
+  Source *source = NULL;
+  pthread_mutex_lock(&m_lock);
+  SourceMap::iterator it = m_sources.find(name);
+  if (it != m_sources.end())
+    source = it->second;
+  pthread_mutex_unlock(&m_lock);
+  return source;
+}
+
+bool CDataCache::Stale(const Source *source)
+{
+  return !source->m_valid || GetTime() - source->m_refreshed >= source->m_ttl;
+}
+
+IDataSource *CDataCache::Acquire(const std::string &name)
+{
+  Source *source = Find(name);
+  if (!source)
+    return NULL;
+
+  pthread_rwlock_rdlock(&source->m_lock);
+  if (!Stale(source))
+  {
+    CMetrics::Add("cache." + name + ".hits", 1);
+    return source->m_source;
+  }
+  pthread_rwlock_unlock(&source->m_lock);
+
+  /* the first job to find it stale refreshes it, the rest wait and share it */
+  pthread_rwlock_wrlock(&source->m_lock);
+  if (Stale(source))
+  {
+    const uint64_t start = GetTime();
+    source->m_source->Refresh();
+    source->m_refreshed = GetTime();
+    source->m_valid     = true;
+    CMetrics::Add("cache." + name + ".refreshes" , 1);
+    CMetrics::Set("cache." + name + ".refresh_ms", source->m_refreshed - start);
+  }
+  else
+    CMetrics::Add("cache." + name + ".hits", 1);
+  pthread_rwlock_unlock(&source->m_lock);
+
+  /*
+   * the snapshot can not expire again before we get the read lock unless
+   * the TTL is shorter than the wait, using it anyway is harmless
+   */
+  pthread_rwlock_rdlock(&source->m_lock);
+  return source->m_source;
+}
+
+void CDataCache::Release(const std::string &name)
+{
+  Source *source = Find(name);
+  if (source)
+    pthread_rwlock_unlock(&source->m_lock);
+}
+
+void CDataCache::Sorted(const StringList &names, StringList &sorted)
+{
+  sorted = names;
+  std::sort(sorted.begin(), sorted.end());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+}
+
+void CDataCache::Acquire(const StringList &names)
+{
+  StringList sorted;
+  Sorted(names, sorted);
+  for(StringList::iterator it = sorted.begin(); it != sorted.end(); ++it)
+    Acquire(*it);
+}
+
+void CDataCache::Release(const StringList &names)
+{
+  StringList sorted;
+  Sorted(names, sorted);
+  for(StringList::reverse_iterator it = sorted.rbegin(); it != sorted.rend(); ++it)
+    Release(*it);
+}
+
+void CDataCache::Invalidate(const std::string &name)
+{
+  Source *source = Find(name);
+  if (!source)
+    return;
+
+  pthread_rwlock_wrlock(&source->m_lock);
+  source->m_valid = false;
+  pthread_rwlock_unlock(&source->m_lock);
+}
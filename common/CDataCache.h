@@ -0,0 +1,111 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CDATACACHE_H_
+#define _CDATACACHE_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <map>
+
+/**
+  * Collects one kind of host data, such as the process list, for
+  * CDataCache to share between jobs
+  */
+class IDataSource
+{
+  public:
+    IDataSource() {}
+    virtual ~IDataSource() {}
+
+    /**
+      * Replace the last snapshot with a fresh one, this is only called
+      * while no job holds the source
+      */
+    virtual void Refresh() = 0;
+};
+
+/**
+  * A process wide registry of data sources shared by the scheduler's jobs.
+  *
+  * A source is refreshed when it is acquired and its snapshot is older
+  * than its TTL, so jobs that run in the same cycle share one read of
+  * /proc, sysfs or the block devices. A snapshot is never refreshed while
+  * it is held, so a job sees the same data for the whole of its run.
+  *
+  * Jobs declare the sources they read with ISchedulerJob::GetDependencies
+  * and the scheduler holds them for the job's run. Lists of sources are
+  * always acquired in name order so jobs sharing them cannot deadlock.
+  */
+class CDataCache
+{
+  public:
+    typedef std::vector<std::string> StringList;
+
+    /**
+      * Add a source, this should be done before the scheduler is run
+      * @param name   The name jobs refer to the source by
+      * @param source The source, owned by the caller
+      * @param ttl    The milliseconds a snapshot may be reused for
+      */
+    static void Register(const std::string &name, IDataSource *source, const unsigned int ttl);
+
+    /**
+      * Hold a source, refreshing it first if its snapshot has expired
+      * @return The source, or NULL if no source has the name
+      */
+    static IDataSource *Acquire(const std::string &name);
+    static void         Release(const std::string &name);
+
+    /**
+      * Hold or release a list of sources, names without a source are ignored
+      */
+    static void Acquire(const StringList &names);
+    static void Release(const StringList &names);
+
+    /**
+      * Expire a source's snapshot so the next Acquire refreshes it
+      */
+    static void Invalidate(const std::string &name);
+
+  private:
+    struct Source
+    {
+      IDataSource     *m_source;
+      unsigned int     m_ttl;       /* milliseconds */
+      uint64_t         m_refreshed; /* CLOCK_MONOTONIC milliseconds */
+      bool             m_valid;
+      pthread_rwlock_t m_lock;      /* read for jobs, write to refresh */
+    };
+
+    typedef std::map<std::string, Source *> SourceMap;
+
+    static pthread_mutex_t m_lock;
+    static SourceMap       m_sources;
+
+    static Source  *Find  (const std::string &name);
+    static bool     Stale (const Source *source);
+    static uint64_t GetTime();
+    static void     Sorted(const StringList &names, StringList &sorted);
+};
+
+#endif // _CDATACACHE_H_
@@ -0,0 +1,167 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CGovernor.h"
+#include "CMetrics.h"
+
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+/* older glibc has no wrapper for ioprio_set */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE  3
+#define IOPRIO_WHO_PROCESS 1
+
+CGovernor::CGovernor() :
+  m_bytesRate(0),
+  m_opsRate  (0),
+  m_bytes    (0),
+  m_ops      (0),
+  m_last     (GetTime()),
+  m_idleIO   (false),
+  m_idleCPU  (false),
+  m_nice     (0)
+{
+  pthread_mutex_init(&m_lock, NULL);
+}
+
+CGovernor::~CGovernor()
+{
+  pthread_mutex_destroy(&m_lock);
+}
+
+uint64_t CGovernor::GetTime()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void CGovernor::SetLimits(const uint64_t bytes, const uint64_t ops)
+{
+  pthread_mutex_lock(&m_lock);
+  m_bytesRate = bytes;
+  m_opsRate   = ops;
+
+  /* start full so short jobs are not delayed at all */
+  m_bytes     = bytes;
+  m_ops       = ops;
+  m_last      = GetTime();
+  pthread_mutex_unlock(&m_lock);
+}
+
+void CGovernor::SetPriority(const bool idleIO, const bool idleCPU, const int nice)
+{
+  m_idleIO  = idleIO;
+  m_idleCPU = idleCPU;
+  m_nice    = nice;
+}
+
+void CGovernor::SetAffinity(const std::vector<int> &cpus)
+{
+  m_cpus = cpus;
+}
+
+void CGovernor::Apply()
+{
+  /* these all act on the calling thread only */
+  if (m_idleIO)
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+  if (m_nice != 0)
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), m_nice);
+
+  if (m_idleCPU)
+  {
+    struct sched_param param;
+    param.sched_priority = 0;
+    sched_setscheduler(0, SCHED_IDLE, &param);
+  }
+
+  if (!m_cpus.empty())
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(std::vector<int>::const_iterator it = m_cpus.begin(); it != m_cpus.end(); ++it)
+      CPU_SET(*it, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+  }
+}
+
+void CGovernor::Throttle(const uint64_t bytes)
+{
+  if (m_bytesRate == 0 && m_opsRate == 0)
+    return;
+
+  uint64_t wait = 0;
+  pthread_mutex_lock(&m_lock);
+  {
+    /* refill the buckets, holding at most a second's worth */
+    const uint64_t now     = GetTime();
+    const double   elapsed = (double)(now - m_last) / 1000000.0;
+    m_last = now;
+
+    if (m_bytesRate > 0)
+    {
+      m_bytes += elapsed * m_bytesRate;
+      if (m_bytes > m_bytesRate)
+        m_bytes = m_bytesRate;
+
+      /* take the tokens now, going into debt makes the next caller wait */
+      m_bytes -= bytes;
+      if (m_bytes < 0)
+        wait = (uint64_t)(-m_bytes * 1000000.0 / m_bytesRate);
+    }
+
+    if (m_opsRate > 0)
+    {
+      m_ops += elapsed * m_opsRate;
+      if (m_ops > m_opsRate)
+        m_ops = m_opsRate;
+
+      m_ops -= 1;
+      if (m_ops < 0)
+      {
+        const uint64_t opsWait = (uint64_t)(-m_ops * 1000000.0 / m_opsRate);
+        if (opsWait > wait)
+          wait = opsWait;
+      }
+    }
+  }
+  pthread_mutex_unlock(&m_lock);
+
+  CMetrics::Add("governor.bytes", bytes);
+  CMetrics::Add("governor.ops"  , 1    );
+  if (wait == 0)
+    return;
+
+  CMetrics::Add("governor.waits"  , 1   );
+  CMetrics::Add("governor.wait_us", wait);
+
+  struct timespec ts;
+  ts.tv_sec  = wait / 1000000;
+  ts.tv_nsec = (wait % 1000000) * 1000;
+  while(nanosleep(&ts, &ts) < 0 && errno == EINTR) {}
+}
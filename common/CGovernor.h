@@ -0,0 +1,91 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CGOVERNOR_H_
+#define _CGOVERNOR_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+/**
+  * Limits the resources background jobs may take from the host.
+  *
+  * Reads are rate limited by token buckets on bytes and operations per
+  * second that are shared by every thread using the governor, and the
+  * threads and processes doing the work can be dropped to idle I/O and
+  * CPU priority and pinned to housekeeping cores.
+  */
+class CGovernor
+{
+  public:
+    CGovernor();
+    ~CGovernor();
+
+    /**
+      * Set the read limits
+      * @param bytes Bytes per second, 0 for no limit
+      * @param ops   Read operations per second, 0 for no limit
+      */
+    void SetLimits(const uint64_t bytes, const uint64_t ops);
+
+    /**
+      * Set the priority applied by Apply
+      * @param idleIO  Use the idle I/O scheduling class
+      * @param idleCPU Use the SCHED_IDLE policy
+      * @param nice    The nice value, for when SCHED_IDLE is unavailable
+      */
+    void SetPriority(const bool idleIO, const bool idleCPU, const int nice);
+
+    /**
+      * Restrict Apply to a set of CPUs, empty for no restriction
+      */
+    void SetAffinity(const std::vector<int> &cpus);
+
+    /**
+      * Apply the priority and affinity to the calling thread, children
+      * forked by the thread inherit them
+      */
+    void Apply();
+
+    /**
+      * Wait until a read of this size is allowed
+      * @param bytes The size of the read
+      */
+    void Throttle(const uint64_t bytes);
+
+  private:
+    pthread_mutex_t  m_lock;
+    uint64_t         m_bytesRate;
+    uint64_t         m_opsRate;
+    double           m_bytes;   /* tokens available, negative when in debt */
+    double           m_ops;
+    uint64_t         m_last;    /* microseconds */
+
+    bool             m_idleIO;
+    bool             m_idleCPU;
+    int              m_nice;
+    std::vector<int> m_cpus;
+
+    static uint64_t GetTime();
+};
+
+#endif // _CGOVERNOR_H_
@@ -21,17 +21,40 @@
 #include "CHTTP.h"
 
 #include "CCommon.h"
+#include "CMetrics.h"
 #include "RootCerts.h"
 #include "polarssl/net.h"
 #include <sys/socket.h>
 #include <pcrecpp.h>
 #include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+/* the seconds the client offers to resume a TLS session for */
+#define HTTP_SESSION_TIMEOUT 3600
+
+/* the most bytes accepted for a reply's headers or a chunk header */
+#define HTTP_MAX_HEAD 65536
+
+/* the most bytes accepted for a reply's body, the server's replies are small */
+#define HTTP_MAX_BODY (16 * 1024 * 1024)
+
 CHTTP::CHTTP() :
-  m_connected(false)
+  m_connected(false),
+  m_ssl      (false),
+  m_port     (0    ),
+  m_requests (0    ),
+  m_lastUsed (0    ),
+  m_idleLimit(0    ),
+  m_reused   (false),
+  m_received (false)
 {
+  memset(&m_sslContext, 0, sizeof(m_sslContext));
+  memset(&m_sslSession, 0, sizeof(m_sslSession));
+
   x509_cert *current;
   m_sslCACerts = current = new x509_cert;
   memset(current, 0, sizeof(x509_cert));
@@ -66,17 +89,74 @@ CHTTP::~CHTTP()
   }
 }
 
+static std::string GetHeader(const CHTTP::HeaderMap &headers, const char *name)
+{
+  CHTTP::HeaderMap::const_iterator it = headers.find(name);
+  return it == headers.end() ? std::string() : it->second;
+}
+
+uint64_t CHTTP::GetTime()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int CHTTP::Send(void *ctx, const unsigned char *buf, size_t len)
+{
+  /* as net_send, but a connection the server has closed must not raise SIGPIPE */
+  int ret = send(*((int *)ctx), buf, len, MSG_NOSIGNAL);
+  if (ret >= 0)
+    return ret;
+
+  if (errno == EAGAIN || errno == EINTR)
+    return POLARSSL_ERR_NET_WANT_WRITE;
+
+  if (errno == EPIPE || errno == ECONNRESET)
+    return POLARSSL_ERR_NET_CONN_RESET;
+
+  return POLARSSL_ERR_NET_SEND_FAILED;
+}
+
+bool CHTTP::IsStale()
+{
+  /* the server closes connections that have been idle for too long */
+  if (m_idleLimit > 0 && GetTime() - m_lastUsed >= (uint64_t)m_idleLimit * 1000)
+    return true;
+
+  /*
+   * nothing is sent between replies, so a readable socket means the server
+   * has closed it or sent a close notify
+   */
+  struct pollfd pfd;
+  pfd.fd      = m_sslFD;
+  pfd.events  = POLLIN;
+  pfd.revents = 0;
+  return poll(&pfd, 1, 0) != 0 || !m_buffer.empty();
+}
+
 bool CHTTP::Connect(const std::string &host, const int port, const bool ssl)
 {
   if (m_connected)
-    return false;
+  {
+    if (host == m_host && port == m_port && ssl == m_ssl && !IsStale())
+    {
+      CMetrics::Add("http.reused", 1);
+      return true;
+    }
+    Disconnect();
+  }
 
-  m_ssl = ssl;
+  m_ssl       = ssl;
+  m_host      = host;
+  m_port      = port;
+  m_requests  = 0;
+  m_idleLimit = 0;
+  m_buffer.clear();
 
   if (ssl)
   {
     memset(&m_sslContext, 0, sizeof(m_sslContext));
-    memset(&m_sslSession, 0, sizeof(m_sslSession));
 
     if (net_connect(&m_sslFD, host.c_str(), port) != 0)
       return false;
@@ -85,28 +165,39 @@ bool CHTTP::Connect(const std::string &host, const int port, const bool ssl)
     ssl_set_endpoint    (&m_sslContext, SSL_IS_CLIENT);
     ssl_set_authmode    (&m_sslContext, SSL_VERIFY_OPTIONAL);
     ssl_set_rng         (&m_sslContext, ctr_drbg_random, CCommon::GetDRBG());
-    ssl_set_bio         (&m_sslContext, net_recv, &m_sslFD, net_send, &m_sslFD);
+    ssl_set_bio         (&m_sslContext, net_recv, &m_sslFD, &CHTTP::Send, &m_sslFD);
     ssl_set_ciphersuites(&m_sslContext, ssl_default_ciphersuites);
-    ssl_set_session     (&m_sslContext, 1, 600, &m_sslSession);
+    ssl_set_session     (&m_sslContext, 1, HTTP_SESSION_TIMEOUT, &m_sslSession);
     ssl_set_ca_chain    (&m_sslContext, m_sslCACerts, NULL, host.c_str());
 
     struct sockaddr_in local_address;
     socklen_t addr_size = sizeof(local_address);
     getsockname(m_sslFD, (sockaddr *)&local_address, &addr_size);
 
-    /* handshake */
+    /* handshake, resuming the last session if the server still has it */
+    const uint64_t start = GetTime();
     int ret;
     while((ret = ssl_handshake(&m_sslContext)) != 0)
     {
-      if (ret != POLARSSL_ERR_NET_WANT_READ  || ret != POLARSSL_ERR_NET_WANT_WRITE)
+      if (ret != POLARSSL_ERR_NET_WANT_READ && ret != POLARSSL_ERR_NET_WANT_WRITE)
       {
         fprintf(stderr, "CHTTP::Connect - Failed to perform SSL handshake\n");
+        memset (&m_sslSession, 0, sizeof(m_sslSession));
+        net_close(m_sslFD);
+        ssl_free (&m_sslContext);
         return false;
       }
     }
 
-    /* check the certificate */
-    if ((ret = ssl_get_verify_result(&m_sslContext)) != 0)
+    const bool resumed = m_sslContext.resume != 0;
+    CMetrics::Add(resumed ? "http.resumed" : "http.handshakes", 1);
+    CMetrics::Set("http.handshake_ms", GetTime() - start);
+
+    /*
+     * check the certificate, a resumed session was checked when it was
+     * established and the server does not send it again
+     */
+    if (!resumed && (ret = ssl_get_verify_result(&m_sslContext)) != 0)
     {
       fprintf(stderr, "CHTTP::Connect - SSL certificate failed to verify:\n");
       if (ret & BADCERT_EXPIRED    ) fprintf(stderr, " * BADCERT_EXPIRED\n"    );
@@ -115,6 +206,10 @@ bool CHTTP::Connect(const std::string &host, const int port, const bool ssl)
       if (ret & BADCERT_NOT_TRUSTED) fprintf(stderr, " * BADCERT_NOT_TRUSTED\n");
       fprintf(stderr, "\n");
 
+      /* never offer a session with an untrusted server again */
+      memset   (&m_sslSession, 0, sizeof(m_sslSession));
+      net_close(m_sslFD);
+      ssl_free (&m_sslContext);
       return false; 
     }
 
@@ -122,6 +217,7 @@ bool CHTTP::Connect(const std::string &host, const int port, const bool ssl)
     inet_ntop(AF_INET, &local_address.sin_addr, s, sizeof(s));
     m_localIP.assign(s);
 
+    m_lastUsed  = GetTime();
     m_connected = true;
     return true;
   }
@@ -140,6 +236,7 @@ void CHTTP::Disconnect()
 
   if (m_ssl)
   {
+    /* the session is kept so the next connection can resume it */
     ssl_close_notify(&m_sslContext);
     net_close       (m_sslFD);
     ssl_free        (&m_sslContext);
@@ -150,6 +247,7 @@ void CHTTP::Disconnect()
     /* FIXME */
   }
 
+  m_buffer.clear();
   m_connected = false;
 }
 
@@ -172,9 +270,9 @@ void CHTTP::ClearHeaders()
   m_headers.clear();
 }
 
-void CHTTP::AppendHeaders(std::stringstream &request)
+void CHTTP::AppendHeaders(std::stringstream &request, const HeaderMap &headers)
 {
-  for(HeaderMap::iterator header = m_headers.begin(); header != m_headers.end(); ++header)
+  for(HeaderMap::const_iterator header = headers.begin(); header != headers.end(); ++header)
   {
     for(unsigned int i = 0; i < header->first.length(); ++i)
     {
@@ -188,6 +286,11 @@ void CHTTP::AppendHeaders(std::stringstream &request)
 }
 
 bool CHTTP::Write(const std::string &buffer)
+{
+  return Write(buffer.c_str(), buffer.length());
+}
+
+bool CHTTP::Write(const char *buffer, const size_t length)
 {
   if (!m_connected)
     return false;
@@ -195,12 +298,10 @@ bool CHTTP::Write(const std::string &buffer)
   int ret;
   if (m_ssl)
   {
-    int offset = 0;
-    int length = buffer.length();
-
-    while(length > 0)
+    size_t offset = 0;
+    while(offset < length)
     {
-      ret = ssl_write(&m_sslContext, (unsigned char*)buffer.c_str() + offset, length);
+      ret = ssl_write(&m_sslContext, (unsigned char*)buffer + offset, length - offset);
       if (ret <= 0)
       {
         if (ret == POLARSSL_ERR_NET_WANT_WRITE)
@@ -209,9 +310,8 @@ bool CHTTP::Write(const std::string &buffer)
       }
 
       offset += ret;
-      length -= ret;
     }
-    return length == 0;
+    return true;
   }
   else
   {
@@ -220,7 +320,7 @@ bool CHTTP::Write(const std::string &buffer)
   }
 }
 
-bool CHTTP::Read(std::stringstream &buffer)
+bool CHTTP::Fill()
 {
   if (!m_connected)
     return false;
@@ -228,26 +328,19 @@ bool CHTTP::Read(std::stringstream &buffer)
   int ret;
   if (m_ssl)
   {
-    buffer.str(std::string());
     while(1)
     {
-      unsigned char result[1024];
+      unsigned char result[4096];
       ret = ssl_read(&m_sslContext, result, sizeof(result));
       if (ret == POLARSSL_ERR_NET_WANT_READ)
         continue;
 
-      if (ret == POLARSSL_ERR_SSL_PEER_CLOSE_NOTIFY || ret == 0)
-      {
-        Disconnect();
-        return true;
-      }
-
-      if(ret < 0)
+      if (ret <= 0)
         return false;
 
-      buffer.write((char*)result, ret);
+      m_buffer.append((char*)result, ret);
+      return true;
     }
-    return true;
   }
   else
   {
@@ -256,37 +349,101 @@ bool CHTTP::Read(std::stringstream &buffer)
   }
 }
 
-bool CHTTP::PerformRequest(const char *method, const std::string &uri, int &error, HeaderMap &headers, std::string &body)
+bool CHTTP::ReadLine(std::string &line)
 {
-  error = 0;
-  headers.clear();
+  size_t end;
+  while((end = m_buffer.find('\n')) == std::string::npos)
+  {
+    if (m_buffer.length() > HTTP_MAX_HEAD || !Fill())
+      return false;
+  }
 
-  std::stringstream request, result;
-  request << method << " " << uri << " HTTP/1.0\r\n";
-  AppendHeaders(request);
-  request << "\r\n";
-  request << body;
+  line.assign(m_buffer, 0, end);
+  m_buffer.erase(0, end + 1);
+  if (!line.empty() && line[line.length() - 1] == '\r')
+    line.erase(line.length() - 1);
+  return true;
+}
 
-  if (!Write(request.str()))
-    return false;
+bool CHTTP::ReadBytes(const size_t length, std::string &data)
+{
+  while(m_buffer.length() < length)
+    if (!Fill())
+      return false;
+
+  data.append(m_buffer, 0, length);
+  m_buffer.erase(0, length);
+  return true;
+}
+
+bool CHTTP::ReadChunked(std::string &body)
+{
+  std::string line;
+  while(true)
+  {
+    /* the chunk size in hex, optionally followed by extensions */
+    if (!ReadLine(line))
+      return false;
+
+    char *end;
+    const unsigned long size = strtoul(line.c_str(), &end, 16);
+    if (end == line.c_str())
+      return false;
+
+    if (size == 0)
+      break;
+
+    if (size > HTTP_MAX_BODY - body.length())
+      return false;
 
-  if (!Read(result))
+    if (!ReadBytes(size, body) || !ReadLine(line) || !line.empty())
+      return false;
+  }
+
+  /* skip any trailers up to the blank line that ends the reply */
+  do
+  {
+    if (!ReadLine(line))
+      return false;
+  }
+  while(!line.empty());
+
+  return true;
+}
+
+bool CHTTP::ReadResponse(const char *method, int &error, HeaderMap &headers, std::string &body, bool &received)
+{
+  received = false;
+  body.clear();
+
+  /* read the status line and headers */
+  std::string head, line;
+  if (!ReadLine(line))
     return false;
+  received = true;
+
+  do
+  {
+    head.append(line);
+    head.append("\r\n");
+    if (head.length() > HTTP_MAX_HEAD || !ReadLine(line))
+      return false;
+  }
+  while(!line.empty());
 
   /* break apart the response */
   pcrecpp::RE_Options  options;
   options.set_multiline(true);
   options.set_dotall   (true);
-  std::string httpVersion, httpError, httpMsg, httpHeaders, httpBody;
+  std::string httpVersion, httpError, httpMsg, httpHeaders;
   if (!pcrecpp::RE(
-      "^HTTP/(\\d\\.\\d)\\s+(\\d+)\\s+(.+?)(?:\\r\\n|\\n|\\r)(.+?)(?:\\r\\n\\r\\n|\\n\\n|\\r\\r)(.*)$",
+      "^HTTP/(\\d\\.\\d)\\s+(\\d+)\\s*(.*?)\\r\\n(.*)$",
       options
-    ).FullMatch(result.str(),
+    ).FullMatch(head,
       &httpVersion,
       &httpError,
       &httpMsg,
-      &httpHeaders,
-      &body
+      &httpHeaders
     )) return false;
 
   /* parse the HTTP error code */
@@ -294,7 +451,7 @@ bool CHTTP::PerformRequest(const char *method, const std::string &uri, int &erro
 
   /* break apart the headers */
   pcrecpp::StringPiece input(httpHeaders);
-  pcrecpp::RE re("^([^ :]+): (.+)(?:\\r\\n|\\n|\\r)");
+  pcrecpp::RE re("^([^ :]+):\\s*(.*?)\\r\\n");
   std::string name, value;
   while(re.FindAndConsume(&input, &name, &value))
   {
@@ -313,5 +470,115 @@ bool CHTTP::PerformRequest(const char *method, const std::string &uri, int &erro
     headers[CCommon::StrToLower(name)] = value;
   }
 
+  /* HTTP/1.1 connections persist unless closed, HTTP/1.0 ones only if asked */
+  const std::string connection = CCommon::StrToLower(GetHeader(headers, "connection"));
+  bool keepAlive = httpVersion == "1.0" ?
+    connection == "keep-alive" :
+    connection != "close";
+
+  /* the server may say how long it will keep the connection idle for */
+  unsigned int timeout;
+  if (pcrecpp::RE("timeout=(\\d+)").PartialMatch(GetHeader(headers, "keep-alive"), &timeout))
+    m_idleLimit = timeout;
+
+  /* find where the body ends */
+  const bool noBody =
+    strcmp(method, "HEAD") == 0 ||
+    (error >= 100 && error < 200) ||
+    error == 204 ||
+    error == 304;
+
+  if (noBody)
+    ;
+  else if (CCommon::StrToLower(GetHeader(headers, "transfer-encoding")).find("chunked") != std::string::npos)
+  {
+    if (!ReadChunked(body))
+      return false;
+  }
+  else if (headers.find("content-length") != headers.end())
+  {
+    const std::string   value  = GetHeader(headers, "content-length");
+    char               *end;
+    const unsigned long length = strtoul(value.c_str(), &end, 10);
+    if (end == value.c_str() || length > HTTP_MAX_BODY || !ReadBytes(length, body))
+      return false;
+  }
+  else
+  {
+    /* the body runs until the server closes the connection */
+    body.swap(m_buffer);
+    while(body.length() <= HTTP_MAX_BODY && Fill())
+    {
+      body.append(m_buffer);
+      m_buffer.clear();
+    }
+
+    if (body.length() > HTTP_MAX_BODY)
+      return false;
+    keepAlive = false;
+  }
+
+  if (!keepAlive)
+    Disconnect();
+
   return true;
 }
+
+bool CHTTP::BeginRequest(const char *method, const std::string &uri)
+{
+  std::stringstream request;
+  request << method << " " << uri << " HTTP/1.1\r\n";
+  AppendHeaders(request, m_headers);
+  request << "Transfer-Encoding: chunked\r\n";
+  request << "\r\n";
+
+  /*
+   * the server may close a reused connection just as we send the request,
+   * the caller can send it again on a new one if none of the reply arrived
+   */
+  m_method   = method;
+  m_reused   = m_requests > 0;
+  m_received = false;
+
+  ++m_requests;
+  if (Write(request.str()))
+    return true;
+
+  Disconnect();
+  return false;
+}
+
+bool CHTTP::WriteChunk(const char *data, const size_t length)
+{
+  /* an empty chunk would end the body */
+  if (length == 0)
+    return true;
+
+  char size[32];
+  snprintf(size, sizeof(size), "%lx\r\n", (unsigned long)length);
+  if (Write(size, strlen(size)) && Write(data, length) && Write("\r\n", 2))
+    return true;
+
+  Disconnect();
+  return false;
+}
+
+bool CHTTP::EndRequest(const HeaderMap &trailers, int &error, HeaderMap &headers, std::string &body)
+{
+  error = 0;
+  headers.clear();
+
+  std::stringstream end;
+  end << "0\r\n";
+  AppendHeaders(end, trailers);
+  end << "\r\n";
+
+  if (Write(end.str()) && ReadResponse(m_method.c_str(), error, headers, body, m_received))
+  {
+    m_lastUsed = GetTime();
+    return true;
+  }
+
+  Disconnect();
+  return false;
+}
@@ -31,6 +31,18 @@
 #include "polarssl/ctr_drbg.h"
 #include "polarssl/x509.h"
 
+/**
+  * A HTTP/1.1 client that keeps its connection open between requests.
+  *
+  * Connect reuses the open connection if it is to the same host and still
+  * usable. The server may have closed a reused connection while it was
+  * idle, so a request that fails on one before any of the reply arrives can
+  * be sent again on a new one, see CanRetry. New connections offer the last TLS session
+  * so the server can resume it without a full handshake.
+  *
+  * Handshakes are counted by the http.handshakes and http.resumed metrics
+  * and the last one's time is kept by http.handshake_ms.
+  */
 class CHTTP
 {
   public:
@@ -48,14 +60,39 @@ class CHTTP
     typedef std::map<std::string, std::string> HeaderMap;
 
     /**
-      * Performs a HTTP request
-      * @param  method  The HTTP method to use (ie: GET, POST)
-      * @param  error   The HTTP error response code (ie: 200, 404)
-      * @param  headers The HTTP headers returned
-      * @param  body    This is input and output, input will be the body of the request, output will be the body of the reply
-      * @return         True if valid HTTP communication was established with the server, not if error == 200.
-      */   
-    bool PerformRequest(const char *method, const std::string &uri, int &error, HeaderMap &headers, std::string &body);
+      * Start a request whose body is streamed with chunked encoding, the
+      * headers must not include a Content-Length.
+      * @param  method The HTTP method to use (ie: POST)
+      * @return        False if the request could not be sent
+      */
+    bool BeginRequest(const char *method, const std::string &uri);
+
+    /**
+      * Send the next part of a streamed request's body
+      */
+    bool WriteChunk(const char *data, const size_t length);
+
+    /**
+      * End a streamed request and read the reply
+      * @param  trailers Headers sent after the body, such as a signature of it
+      * @param  error    The HTTP error response code (ie: 200, 404)
+      * @param  headers  The HTTP headers returned
+      * @param  body     The body of the reply
+      * @return          True if valid HTTP communication was established with the server
+      */
+    bool EndRequest(const HeaderMap &trailers, int &error, HeaderMap &headers, std::string &body);
+
+    /**
+      * True if the streamed request is on a reused connection
+      */
+    bool IsReused() const { return m_reused; }
+
+    /**
+      * True if the streamed request failed on a reused connection before
+      * any of the reply arrived, so it is safe to send it again, Connect
+      * will open a new connection for it
+      */
+    bool CanRetry() const { return m_reused && !m_received; }
 
   private:
     bool             m_connected;
@@ -63,16 +100,36 @@ class CHTTP
     std::string      m_localIP;
     HeaderMap        m_headers;
 
+    /* the connection, kept so it can be reopened */
+    std::string      m_host;
+    int              m_port;
+    unsigned int     m_requests;  /* requests made on the connection */
+    uint64_t         m_lastUsed;  /* CLOCK_MONOTONIC milliseconds */
+    unsigned int     m_idleLimit; /* seconds the server keeps it idle, 0 if unknown */
+    std::string      m_buffer;    /* read but not yet parsed */
+    std::string      m_method;    /* of the streamed request */
+    bool             m_reused;    /* the streamed request is on a reused connection */
+    bool             m_received;  /* some of the streamed request's reply arrived */
+
     /* polarssl vars */
     ssl_context      m_sslContext;
-    ssl_session      m_sslSession;
+    ssl_session      m_sslSession; /* kept between connections to resume it */
     x509_cert       *m_sslCACerts;
     int              m_sslFD;
 
     bool Write(const std::string &buffer);
-    bool Read (std::stringstream &buffer);
+    bool Write(const char *buffer, const size_t length);
+    bool Fill     ();
+    bool ReadLine (std::string &line);
+    bool ReadBytes(const size_t length, std::string &data);
+    bool ReadChunked(std::string &body);
+    bool ReadResponse(const char *method, int &error, HeaderMap &headers, std::string &body, bool &received);
+    bool IsStale();
+
+    void AppendHeaders(std::stringstream &request, const HeaderMap &headers);
 
-    void AppendHeaders(std::stringstream &request);
+    static int      Send   (void *ctx, const unsigned char *buf, size_t len);
+    static uint64_t GetTime();
 };
 
 #endif // _CHTTP_H_
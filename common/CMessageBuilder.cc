@@ -21,6 +21,7 @@
 #include "CMessageBuilder.h"
 #include "CCommon.h"
 #include "CCompress.h"
+#include "CMetrics.h"
 
 #include <sys/stat.h>
 #include <assert.h>
@@ -28,11 +29,90 @@
 #include <sstream>
 #include <fstream>
 #include <string.h>
+#include <time.h>
 
 #include "polarssl/sha1.h"
 #include "polarssl/base64.h"
 #include "polarssl/x509write.h"
 
+/* the most spooled messages replayed ahead of each new message */
+#define SPOOL_BATCH 32
+
+/* the size of the blocks spooled messages are replayed in */
+#define SPOOL_BLOCK 65536
+
+/* the most deflated bytes kept to send a message again on a new connection */
+#define RESEND_MAX (4 * 1024 * 1024)
+
+/*
+ * hashes the deflated message for its signature as it is streamed to the
+ * server, and copies it to the spool in case it can not be delivered, and
+ * to a buffer if it is sent on a reused connection so it can be sent again
+ * on a new one
+ */
+class CUploadSink : public IDeflateSink
+{
+  public:
+    CUploadSink(CHTTP *http, CSpool *spool) :
+      m_http (http ),
+      m_spool(spool),
+      m_keep (NULL ),
+      m_send (true )
+    {
+      sha1_starts(&m_sha);
+    }
+
+    virtual bool Write(const char *data, const size_t length)
+    {
+      sha1_update(&m_sha, (const unsigned char *)data, length);
+
+      if (m_spool && !m_spool->Append(data, length))
+        m_spool = NULL;
+
+      if (m_send && !m_http->WriteChunk(data, length))
+      {
+        m_send = false;
+        if (!m_http->CanRetry())
+          m_keep = NULL;
+      }
+
+      if (m_keep)
+      {
+        if (m_keep->GetLength() + length > RESEND_MAX)
+          m_keep = NULL;
+        else
+          m_keep->sputn(data, length);
+      }
+
+      return m_send || m_spool || m_keep;
+    }
+
+    void GetHash(unsigned char hash[20]) { sha1_finish(&m_sha, hash); }
+
+    void Keep(CChainBuffer *keep) { m_keep = keep; }
+
+    void StopSending () { m_send  = false; }
+    void StopSpooling() { m_spool = NULL;  }
+
+    bool IsSending () const { return m_send;          }
+    bool IsSpooling() const { return m_spool != NULL; }
+    bool IsKept    () const { return m_keep  != NULL; }
+
+  private:
+    CHTTP        *m_http;
+    CSpool       *m_spool; /* NULL if the message is not being spooled */
+    CChainBuffer *m_keep;  /* NULL if the message is not kept to send again */
+    bool          m_send;  /* false once the upload has failed */
+    sha1_context  m_sha;
+};
+
+static uint64_t GetTimeMS()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 CMessageBuilder::CMessageBuilder(const std::string &host, const unsigned int port) :
   m_armthost(host),
   m_armtport(port)
@@ -56,7 +136,7 @@ CMessageBuilder::CMessageBuilder(const std::string &host, const unsigned int por
   m_http.SetHeader("Accept"         , "text/plain");
   m_http.SetHeader("Content-Type"   , "application/octet-stream");
   m_http.SetHeader("Accept-Encoding", "");
-  m_http.SetHeader("Connection"     , "close");
+  m_http.SetHeader("Connection"     , "keep-alive");
 
   InitAuth();
 }
@@ -71,7 +151,11 @@ bool CMessageBuilder::SignPayload(const std::string &payload, std::string &signa
   /* hash the payload */
   unsigned char tmp[20];
   sha1((const unsigned char *)payload.c_str(), payload.length(), tmp);
+  return SignHash(tmp, signature);
+}
 
+bool CMessageBuilder::SignHash(const unsigned char hash[20], std::string &signature)
+{
   /* sign the hash */
   unsigned char buffer[m_rsa.len];
   if (rsa_pkcs1_sign(
@@ -80,8 +164,8 @@ bool CMessageBuilder::SignPayload(const std::string &payload, std::string &signa
     CCommon::GetDRBG(),
     RSA_PRIVATE,
     SIG_RSA_SHA1,
-    sizeof(tmp),
-    tmp,
+    20,
+    (unsigned char *)hash,
     buffer
   ) != 0)
     return false;
@@ -171,7 +255,16 @@ void CMessageBuilder::InitAuth()
 
 void CMessageBuilder::AppendSegment(const std::string &name, SegmentFn fn)
 {
-  m_segments[name] = fn;
+  Segment &segment = m_segments[name];
+  segment.m_fn = fn;
+  segment.m_data.clear();
+}
+
+void CMessageBuilder::AppendSegment(const std::string &name, const std::string &data)
+{
+  Segment &segment = m_segments[name];
+  segment.m_fn   = NULL;
+  segment.m_data = data;
 }
 
 void CMessageBuilder::Reset()
@@ -193,45 +286,18 @@ void CMessageBuilder::PackString(std::ostream &ss, const std::string &value)
 
 bool CMessageBuilder::Send(int &result)
 {
-  std::string body;
-  {
-    bool send = false;
-    std::stringstream total;
-    for(SegmentList::iterator segment = m_segments.begin(); segment != m_segments.end(); ++segment)
-    {
-      uint8_t namelen = segment->first.length();
-      assert(namelen <= 0xFF);
-
-      /* get the data */
-      std::stringstream ss;
-
-      /* skip segments with no data, unless the function is NULL */
-      if (segment->second && !segment->second(ss))
-        continue;
-
-      uint32_t datalen = ss.tellp();
-      ss.seekg(0, std::stringstream::beg);
-
-      total.write((const char *)&namelen, sizeof(namelen));
-      total.write((const char *)&datalen, sizeof(datalen));
-      total << segment->first << ss.str();
-      send = true;
-    }
-
-    /* if there is nothing to send, do not do anything */
-    if (!send)
-    {
-      /* forge a 202 response */
-      result = 202;
-      return true;
-    }
+  std::string reply;
+  return Send(result, reply);
+}
 
-    std::stringstream compressed;
-    CCompress::Deflate(total, compressed);
-    body = compressed.str();
-  }
+bool CMessageBuilder::SetSpool(const std::string &path, const uint64_t cap)
+{
+  return m_spool.Open(path, cap);
+}
 
-  /* connect to the host */
+bool CMessageBuilder::BeginSend(const uint64_t spooled/* = 0 */)
+{
+  /* connect to the host, or reuse the open connection */
   if (!m_http.Connect(m_armthost, m_armtport, true))
     return false;
 
@@ -250,22 +316,261 @@ bool CMessageBuilder::Send(int &result)
     ));
   }
 
-  std::string signature;
-  if (!SignPayload(body, signature))
+  /* the signature is not known until the body has been sent */
+  m_http.SetHeader("X-ARMT-HOST", m_hostname);
+  m_http.SetHeader("X-ARMT-IP"  , m_http.GetLocalIP());
+  m_http.SetHeader("X-ARMT-PUB" , pubkey);
+  m_http.SetHeader("Trailer"    , "X-ARMT-SIG");
+
+  /* a replayed message says when it was spooled */
+  if (spooled)
+       m_http.SetHeader("X-ARMT-SPOOLED", CCommon::IntToStr(spooled));
+  else m_http.DelHeader("X-ARMT-SPOOLED");
+
+  if (m_http.BeginRequest("POST", "/"))
+    return true;
+
+  /* the server may have closed the connection while it was idle */
+  if (!m_http.CanRetry())
     return false;
 
-  m_http.SetHeader("X-ARMT-HOST"   , m_hostname);
-  m_http.SetHeader("X-ARMT-IP"     , m_http.GetLocalIP());
-  m_http.SetHeader("X-ARMT-PUB"    , pubkey);
-  m_http.SetHeader("X-ARMT-SIG"    , signature);
-  m_http.SetHeader("Content-Length", CCommon::IntToStr(body.length()));
+  CMetrics::Add("http.retries", 1);
+  return
+    m_http.Connect(m_armthost, m_armtport, true) &&
+    m_http.BeginRequest("POST", "/");
+}
 
-  /* send the message */
-  CHTTP::HeaderMap headers;
-  if (!m_http.PerformRequest("POST", "/", result, headers, body))
+bool CMessageBuilder::Resend(const CHTTP::HeaderMap &trailers, int &result, CHTTP::HeaderMap &headers, std::string &reply)
+{
+  CMetrics::Add("http.retries", 1);
+  if (!BeginSend())
     return false;
 
-  /* return true as we performed the request, result code needs to be checked for 202 still however */
-  return true;
+  for(size_t i = 0; i < m_resend.GetBlockCount(); ++i)
+  {
+    size_t      length;
+    const char *block = m_resend.GetBlock(i, length);
+    if (!m_http.WriteChunk(block, length))
+      return false;
+  }
+
+  return m_http.EndRequest(trailers, result, headers, reply);
+}
+
+bool CMessageBuilder::Replay()
+{
+  if (m_spool.IsEmpty())
+    return true;
+
+  const uint64_t start = GetTimeMS();
+  uint64_t       bytes = 0;
+  unsigned int   count = 0;
+  bool           ok    = true;
+  char          *block = new char[SPOOL_BLOCK];
+
+  CSpool::Record record;
+  while(ok && count < SPOOL_BATCH && m_spool.Peek(record))
+  {
+    if (!BeginSend(record.m_time))
+    {
+      ok = false;
+      break;
+    }
+
+    bool read = true;
+    for(uint32_t pos = 0; ok && read && pos < record.m_length;)
+    {
+      size_t len = record.m_length - pos;
+      if (len > SPOOL_BLOCK)
+        len = SPOOL_BLOCK;
+
+      read = m_spool.Read(record, pos, block, len);
+      ok   = read && m_http.WriteChunk(block, len);
+      pos += len;
+    }
+
+    /* a record that can not be read will never be sent, drop it */
+    if (!read)
+    {
+      fprintf(stderr, "CMessageBuilder::Replay - Dropped an unreadable spooled message\n");
+      CMetrics::Add("spool.dropped", 1);
+      m_http.Disconnect();
+      m_spool.Pop();
+      ok = true;
+      continue;
+    }
+
+    int              result;
+    std::string      reply;
+    CHTTP::HeaderMap trailers, headers;
+    trailers["X-ARMT-SIG"] = record.m_signature;
+    if (!ok || !m_http.EndRequest(trailers, result, headers, reply))
+    {
+      ok = false;
+      break;
+    }
+
+    /* the server may recover from its own errors, but will never take a message it refused */
+    if (result >= 500)
+    {
+      ok = false;
+      break;
+    }
+
+    if (result != 202)
+      CMetrics::Add("spool.dropped", 1);
+
+    m_spool.Pop();
+    bytes += record.m_length;
+    ++count;
+  }
+  delete[] block;
+
+  if (count > 0)
+  {
+    const uint64_t taken = GetTimeMS() - start;
+    CMetrics::Add("spool.replayed"    , count);
+    CMetrics::Add("spool.replay_bytes", bytes);
+    CMetrics::Set("spool.replay_ms"   , taken);
+    CMetrics::Set("spool.replay_kbps" , bytes * 1000 / 1024 / (taken > 0 ? taken : 1));
+  }
+
+  return ok;
 }
 
+bool CMessageBuilder::Send(int &result, std::string &reply)
+{
+  reply.clear();
+
+  /* spooled messages go first so the server gets them in the order they were made */
+  const bool    spool    = m_spool.IsOpen();
+  const bool    replayed = Replay();
+  const bool    direct   = replayed && m_spool.IsEmpty();
+  const bool    behind   = replayed && !direct; /* the server is up but the backlog is not sent */
+
+  CUploadSink   sink(&m_http, spool ? &m_spool : NULL);
+  CDeflater     deflater(&sink);
+  std::iostream ss(&m_chain);
+  bool          started = false;
+  bool          ok      = true;
+
+  for(SegmentList::iterator segment = m_segments.begin(); ok && segment != m_segments.end(); ++segment)
+  {
+    uint8_t namelen = segment->first.length();
+    assert(namelen <= 0xFF);
+
+    /* collect the data, skip segments with no data unless the function is NULL */
+    const bool collect = segment->second.m_fn != NULL;
+    if (collect)
+    {
+      m_chain.Reset();
+      ss.clear();
+      if (!segment->second.m_fn(ss))
+        continue;
+    }
+
+    /* start the request once there is something to send */
+    if (!started)
+    {
+      if (spool && !m_spool.Begin())
+        sink.StopSpooling();
+
+      if (!direct || !BeginSend())
+        sink.StopSending();
+      else if (m_http.IsReused())
+      {
+        m_resend.Reset();
+        sink.Keep(&m_resend);
+      }
+
+      if (!sink.IsSending() && !sink.IsSpooling())
+        return false;
+      started = true;
+    }
+
+    uint32_t datalen = collect ? m_chain.GetLength() : segment->second.m_data.length();
+    ok =
+      deflater.Write((const char *)&namelen, sizeof(namelen)) &&
+      deflater.Write((const char *)&datalen, sizeof(datalen)) &&
+      deflater.Write(segment->first.c_str(), namelen);
+
+    if (!collect)
+    {
+      ok = ok && deflater.Write(segment->second.m_data.c_str(), datalen);
+      continue;
+    }
+
+    for(size_t i = 0; ok && i < m_chain.GetBlockCount(); ++i)
+    {
+      size_t      length;
+      const char *block = m_chain.GetBlock(i, length);
+      ok = deflater.Write(block, length);
+    }
+  }
+  m_chain.Reset();
+
+  /* if there is nothing to send, do not do anything */
+  if (!started)
+  {
+    /* forge a 202 response */
+    result = 202;
+    return true;
+  }
+
+  /* sign what was sent and send the signature after it */
+  unsigned char hash[20];
+  std::string   signature;
+  if (ok && deflater.Finish())
+  {
+    sink.GetHash(hash);
+    if (!SignHash(hash, signature))
+      signature.clear();
+  }
+
+  /* a request that was not finished can not be used again */
+  if (signature.empty())
+  {
+    if (sink.IsSending())
+      m_http.Disconnect();
+    m_resend.Reset();
+    m_spool.Abort();
+    return false;
+  }
+
+  CHTTP::HeaderMap trailers, headers;
+  trailers["X-ARMT-SIG"] = signature;
+
+  bool sent = sink.IsSending() && m_http.EndRequest(trailers, result, headers, reply);
+
+  /* a reused connection may have been closed by the server while it was
+   * idle, if none of the reply arrived send the message again on a new one */
+  if (!sent && sink.IsKept() && m_http.CanRetry())
+    sent = Resend(trailers, result, headers, reply);
+  m_resend.Reset();
+
+  if (sent)
+  {
+    /* the server may recover from its own errors, so keep the message
+     * to replay as Replay would */
+    if (result >= 500 && sink.IsSpooling())
+      m_spool.Commit(signature);
+    else
+      m_spool.Abort();
+
+    /* return true as we performed the request, result code needs to be checked for 202 still however */
+    return true;
+  }
+
+  /* keep the message until the server can be reached again */
+  if (!sink.IsSpooling() || !m_spool.Commit(signature))
+    return false;
+
+  /* the server is up, the message will be sent with the rest of the backlog */
+  if (behind)
+  {
+    result = 202;
+    return true;
+  }
+
+  return false;
+}
@@ -22,6 +22,8 @@
 #define _CMESSAGEBUILDER_H_
 
 #include "CHTTP.h"
+#include "CChainBuffer.h"
+#include "CSpool.h"
 
 #include <string>
 #include <map>
@@ -38,18 +40,49 @@ class CMessageBuilder
     ~CMessageBuilder();
 
     bool SignPayload(const std::string &payload, std::string &signature);
+    bool SignHash   (const unsigned char hash[20], std::string &signature);
     std::string Base64Encode(const std::string &str);
 
     bool LoadCertificate(const std::string &crt);
     void InitAuth();
 
     void AppendSegment(const std::string &name, SegmentFn fn);
+
+    /**
+      * Append a segment whose data has already been collected
+      */
+    void AppendSegment(const std::string &name, const std::string &data);
     void Reset();
     bool Send(int &result);
 
+    /**
+      * Send the segments, they are deflated and signed as they are streamed
+      * to the server so only one segment is held in memory at a time
+      * @param result The HTTP response code
+      * @param reply  Receives the body of the server's reply
+      * @return       True if the request was performed
+      */
+    bool Send(int &result, std::string &reply);
+
+    /**
+      * Keep messages that could not be sent in a spool and replay them in
+      * order, in batches ahead of each new message, once the server is back
+      * @param path The spool file
+      * @param cap  The most bytes of messages to keep, the oldest are dropped
+      */
+    bool SetSpool(const std::string &path, const uint64_t cap);
+
+    const std::string &GetHostname() const { return m_hostname; }
+
     static void PackString(std::ostream &ss, const std::string &value);
   private:
-    typedef std::map<std::string, SegmentFn> SegmentList;
+    struct Segment
+    {
+      SegmentFn   m_fn;   /* NULL to send m_data */
+      std::string m_data;
+    };
+
+    typedef std::map<std::string, Segment> SegmentList;
 
     std::string  m_armthost;
     unsigned int m_armtport;
@@ -60,6 +93,17 @@ class CMessageBuilder
     std::string  m_hostname;
     SegmentList  m_segments;
     CHTTP        m_http;
+    CChainBuffer m_chain;  /* the segment being sent, reused between sends */
+    CChainBuffer m_resend; /* the deflated message, kept while it is sent on a reused connection */
+    CSpool       m_spool;
+
+    bool BeginSend(const uint64_t spooled = 0);
+    bool Replay   ();
+
+    /**
+      * Send the message kept in m_resend again on a new connection
+      */
+    bool Resend(const CHTTP::HeaderMap &trailers, int &result, CHTTP::HeaderMap &headers, std::string &reply);
 };
 
 #endif // _CMESSAGEBUILDER_H_
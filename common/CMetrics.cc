@@ -0,0 +1,78 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CMetrics.h"
+#include "CMessageBuilder.h"
+
+/* static declarations */
+pthread_mutex_t     CMetrics::m_lock = PTHREAD_MUTEX_INITIALIZER;
+CMetrics::MetricMap CMetrics::m_metrics;
+
+void CMetrics::Add(const std::string &name, const uint64_t value)
+{
+  pthread_mutex_lock(&m_lock);
+  m_metrics[name] += value;
+  pthread_mutex_unlock(&m_lock);
+}
+
+void CMetrics::Set(const std::string &name, const uint64_t value)
+{
+  pthread_mutex_lock(&m_lock);
+  m_metrics[name] = value;
+  pthread_mutex_unlock(&m_lock);
+}
+
+uint64_t CMetrics::Get(const std::string &name)
+{
+  uint64_t value = 0;
+  pthread_mutex_lock(&m_lock);
+  MetricMap::const_iterator it = m_metrics.find(name);
+  if (it != m_metrics.end())
+    value = it->second;
+  pthread_mutex_unlock(&m_lock);
+  return value;
+}
+
+void CMetrics::GetAll(MetricMap &metrics)
+{
+  pthread_mutex_lock(&m_lock);
+  metrics = m_metrics;
+  pthread_mutex_unlock(&m_lock);
+}
+
+bool CMetrics::Pack(std::ostream &ss)
+{
+  MetricMap metrics;
+  GetAll(metrics);
+
+  for(MetricMap::const_iterator it = metrics.begin(); it != metrics.end(); ++it)
+  {
+    CMessageBuilder::PackString(ss, it->first);
+
+    /* we need to always send in LE */
+    unsigned char buffer[8];
+    uint64_t      value = it->second;
+    for(size_t i = 0; i < sizeof(buffer); ++i, value >>= 8)
+      buffer[i] = value & 0xFF;
+    ss.write((const char *)buffer, sizeof(buffer));
+  }
+
+  return !metrics.empty();
+}
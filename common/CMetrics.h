@@ -0,0 +1,55 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CMETRICS_H_
+#define _CMETRICS_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <ostream>
+#include <map>
+
+/**
+  * A process wide registry of named counters, safe to update from any
+  * thread and sent to the server by the METRICS segment
+  */
+class CMetrics
+{
+  public:
+    typedef std::map<std::string, uint64_t> MetricMap;
+
+    static void     Add(const std::string &name, const uint64_t value);
+    static void     Set(const std::string &name, const uint64_t value);
+    static uint64_t Get(const std::string &name);
+    static void     GetAll(MetricMap &metrics);
+
+    /**
+      * Pack every metric as its name followed by a LE uint64
+      * @return False if there are no metrics
+      */
+    static bool Pack(std::ostream &ss);
+
+  private:
+    static pthread_mutex_t m_lock;
+    static MetricMap       m_metrics;
+};
+
+#endif // _CMETRICS_H_
@@ -38,7 +38,7 @@ CPCIInfo::DeviceList  CPCIInfo::m_deviceList;
 void CPCIInfo::ClearCache()
 {
   m_gotDeviceList = false;
-  m_deviceList.empty();
+  m_deviceList.clear();
 }
 
 const CPCIInfo::DeviceList& CPCIInfo::GetDeviceList()
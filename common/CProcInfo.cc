@@ -38,9 +38,9 @@ CProcInfo::BoundList   CProcInfo::m_bindings;
 void CProcInfo::ClearCache()
 {
   m_gotProcessList = false;
-  m_processList.empty();
+  m_processList.clear();
   m_gotBindings = false;
-  m_bindings.empty();
+  m_bindings.clear();
 }
 
 const CProcInfo::ProcessList& CProcInfo::GetProcessList()
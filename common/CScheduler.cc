@@ -19,40 +19,529 @@
  */
 
 #include "CScheduler.h"
+#include "CMetrics.h"
+#include "CDataCache.h"
 
-CScheduler::CScheduler()
+#include <algorithm>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+/* the most events taken from epoll per wait */
+#define SCHEDULER_EVENTS 16
+
+/* the most runs that may be waiting for a worker */
+#define SCHEDULER_QUEUE_DEPTH 256
+
+/* FNV-1a, used to derive the splay */
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+static uint64_t HashString(const std::string &value, uint64_t hash)
+{
+  for(size_t i = 0; i < value.length(); ++i)
+  {
+    hash ^= (unsigned char)value[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+CScheduler::CScheduler() :
+  m_epollFD(-1  ),
+  m_timerFD(-1  ),
+  m_armed  (0   ),
+  m_clock  (NULL),
+  m_splay  (FNV_OFFSET),
+  m_seed   (time(NULL) ^ getpid()),
+  m_queue  (NULL),
+  m_eventFD(-1  ),
+  m_live   (0   ),
+  m_stuck  (0   ),
+  m_surplus(0   )
 {
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init (&m_idle, NULL);
+
+  m_epollFD = epoll_create1(EPOLL_CLOEXEC);
+  m_timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  /* without the timer the deadline is the epoll timeout */
+  if (m_epollFD > -1 && m_timerFD > -1)
+  {
+    struct epoll_event ev;
+    ev.events  = EPOLLIN;
+    ev.data.fd = m_timerFD;
+    if (epoll_ctl(m_epollFD, EPOLL_CTL_ADD, m_timerFD, &ev) < 0)
+    {
+      close(m_timerFD);
+      m_timerFD = -1;
+    }
+  }
 }
 
 CScheduler::~CScheduler()
 {
+  /* let the workers drain the queue, but not wait on abandoned jobs */
+  if (m_queue)
+  {
+    m_queue->Close();
+    pthread_mutex_lock(&m_lock);
+    while(m_live > m_stuck)
+      pthread_cond_wait(&m_idle, &m_lock);
+    pthread_mutex_unlock(&m_lock);
+  }
+
+  /* an abandoned job may still be running and is leaked rather than deleted */
   for(JobList::iterator it = m_jobs.begin(); it != m_jobs.end(); ++it)
   {
     ISchedulerJob *job = *it;
+    TaskMap::iterator task = m_running.find(job);
+    if (task != m_running.end() && task->second->m_abandoned)
+      continue;
     delete job;
   }
+
+  if (m_eventFD > -1)
+    close(m_eventFD);
+
+  if (m_timerFD > -1)
+    close(m_timerFD);
+
+  if (m_epollFD > -1)
+    close(m_epollFD);
+
+  if (m_stuck == 0)
+  {
+    delete m_queue;
+    pthread_cond_destroy (&m_idle);
+    pthread_mutex_destroy(&m_lock);
+  }
+}
+
+uint64_t CScheduler::GetTime()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t CScheduler::Now()
+{
+  return m_clock ? m_clock->GetTime() : GetTime();
+}
+
+bool CScheduler::SetWorkers(const unsigned int workers)
+{
+  if (m_queue || workers == 0)
+    return workers == 0;
+
+  /* the workers wake Run through an eventfd when jobs finish */
+  if (m_epollFD < 0)
+    return false;
+
+  m_eventFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_eventFD < 0)
+    return false;
+
+  struct epoll_event ev;
+  ev.events  = EPOLLIN;
+  ev.data.fd = m_eventFD;
+  if (epoll_ctl(m_epollFD, EPOLL_CTL_ADD, m_eventFD, &ev) < 0)
+  {
+    close(m_eventFD);
+    m_eventFD = -1;
+    return false;
+  }
+
+  m_queue = new TaskQueue(SCHEDULER_QUEUE_DEPTH);
+  for(unsigned int i = 0; i < workers; ++i)
+    if (!StartWorker())
+      return i > 0;
+
+  return true;
+}
+
+bool CScheduler::StartWorker()
+{
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  pthread_mutex_lock(&m_lock);
+  ++m_live;
+  pthread_mutex_unlock(&m_lock);
+
+  pthread_t thread;
+  bool ret = pthread_create(&thread, &attr, WorkerThread, this) == 0;
+  pthread_attr_destroy(&attr);
+
+  if (!ret)
+  {
+    pthread_mutex_lock(&m_lock);
+    --m_live;
+    pthread_mutex_unlock(&m_lock);
+  }
+
+  return ret;
+}
+
+void CScheduler::Execute(ISchedulerJob *job)
+{
+  std::vector<std::string> deps;
+  job->GetDependencies(deps);
+
+  CDataCache::Acquire(deps);
+  job->Execute();
+  CDataCache::Release(deps);
+}
+
+void *CScheduler::WorkerThread(void *arg)
+{
+  CScheduler *self = (CScheduler *)arg;
+  Task       *task;
+  while(self->m_queue->Pop(task))
+  {
+    /* a run that timed out before it started is not run at all */
+    pthread_mutex_lock(&self->m_lock);
+    const bool run = !task->m_abandoned;
+    task->m_started = self->Now();
+    pthread_mutex_unlock(&self->m_lock);
+
+    if (run)
+      Execute(task->m_job);
+
+    pthread_mutex_lock(&self->m_lock);
+    task->m_finished = self->Now();
+    self->m_done.push_back(task);
+
+    /* a worker that was replaced while stuck in a job retires */
+    bool retire = false;
+    if (task->m_abandoned && run)
+    {
+      --self->m_stuck;
+      if (self->m_surplus > 0)
+      {
+        --self->m_surplus;
+        retire = true;
+      }
+    }
+    pthread_mutex_unlock(&self->m_lock);
+
+    /* wake Run, this can only fail if the counter would overflow */
+    const uint64_t one = 1;
+    ssize_t        ret = write(self->m_eventFD, &one, sizeof(one));
+    (void)ret;
+
+    if (retire)
+      break;
+  }
+
+  pthread_mutex_lock(&self->m_lock);
+  --self->m_live;
+  pthread_cond_broadcast(&self->m_idle);
+  pthread_mutex_unlock(&self->m_lock);
+  return NULL;
+}
+
+void CScheduler::SetSplayKey(const std::string &key)
+{
+  m_splay = HashString(key, FNV_OFFSET);
+  m_seed ^= m_splay;
+}
+
+unsigned int CScheduler::Jitter(const unsigned int jitter)
+{
+  return jitter > 0 ? rand_r(&m_seed) % jitter : 0;
+}
+
+void CScheduler::Arm(const uint64_t due)
+{
+  if (m_timerFD < 0 || due == m_armed)
+    return;
+
+  m_armed = due;
+
+  struct itimerspec spec;
+  spec.it_interval.tv_sec  = 0;
+  spec.it_interval.tv_nsec = 0;
+  spec.it_value.tv_sec     = m_armed / 1000;
+  spec.it_value.tv_nsec    = (m_armed % 1000) * 1000000;
+  timerfd_settime(m_timerFD, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+void CScheduler::Dispatch(ISchedulerJob *job, const uint64_t now)
+{
+  const std::string name = job->GetName();
+
+  /* never run a job on top of its previous run */
+  if (m_running.find(job) != m_running.end())
+  {
+    if (!name.empty())
+      CMetrics::Add("job." + name + ".overlaps", 1);
+    return;
+  }
+
+  if (!m_queue)
+  {
+    Execute(job);
+    if (!name.empty())
+      CMetrics::Set("job." + name + ".run_ms", Now() - now);
+    job->Complete();
+    return;
+  }
+
+  Task *task = new Task();
+  task->m_job       = job;
+  task->m_queued    = now;
+  task->m_started   = 0;
+  task->m_finished  = 0;
+  task->m_abandoned = false;
+  m_running[job]    = task;
+  m_queue->Push(task);
+}
+
+bool CScheduler::Finish(Task *task)
+{
+  ISchedulerJob *job = task->m_job;
+  m_running.erase(job);
+
+  bool completed = false;
+  if (!task->m_abandoned)
+  {
+    const std::string name = job->GetName();
+    if (!name.empty())
+    {
+      CMetrics::Set("job." + name + ".queue_ms", task->m_started  - task->m_queued );
+      CMetrics::Set("job." + name + ".run_ms"  , task->m_finished - task->m_started);
+    }
+
+    job->Complete();
+    completed = true;
+  }
+  delete task;
+
+  /* a run once job is done with, unless it is due again */
+  if (job->GetDelayInterval() == 0)
+    Remove(job);
+
+  return completed;
+}
+
+void CScheduler::Expire(const uint64_t now)
+{
+  for(TaskMap::iterator it = m_running.begin(); it != m_running.end(); ++it)
+  {
+    Task              *task    = it->second;
+    const unsigned int timeout = it->first->GetTimeout();
+    if (timeout == 0 || task->m_abandoned || now - task->m_queued < (uint64_t)timeout * 1000)
+      continue;
+
+    /* replace a worker stuck in the job so the others keep running */
+    pthread_mutex_lock(&m_lock);
+    bool stuck = false;
+    if (task->m_finished == 0)
+    {
+      task->m_abandoned = true;
+      if (task->m_started > 0)
+      {
+        stuck = true;
+        ++m_stuck;
+        ++m_surplus;
+      }
+    }
+    pthread_mutex_unlock(&m_lock);
+
+    if (!task->m_abandoned)
+      continue;
+
+    if (stuck)
+      StartWorker();
+
+    const std::string name = it->first->GetName();
+    if (!name.empty())
+      CMetrics::Add("job." + name + ".timeouts", 1);
+  }
+}
+
+void CScheduler::Remove(ISchedulerJob *job)
+{
+  m_jobs.erase(std::remove(m_jobs.begin(), m_jobs.end(), job), m_jobs.end());
+  delete job;
 }
 
-bool CScheduler::Run()
+bool CScheduler::Run(const int timeout/* = -1 */)
 {
-  std::time_t currentTime = std::time(NULL);
+  /* wake for the next deadline or the next run to time out */
+  uint64_t wake = 0;
+  if (!m_heap.empty())
+    wake = m_heap.front().m_due;
+
+  for(TaskMap::iterator it = m_running.begin(); it != m_running.end(); ++it)
+  {
+    const unsigned int limit = it->first->GetTimeout();
+    if (limit == 0 || it->second->m_abandoned)
+      continue;
+
+    const uint64_t expires = it->second->m_queued + (uint64_t)limit * 1000;
+    if (wake == 0 || expires < wake)
+      wake = expires;
+  }
+
+  int wait = timeout;
+  if (wake > 0)
+  {
+    const uint64_t now = Now();
+    if (wake <= now)
+      wait = 0;
+    else if (m_timerFD > -1 && !m_clock)
+      Arm(wake);
+    else if (wait < 0 || wake - now < (uint64_t)wait)
+      wait = wake - now;
+  }
+
+  if (m_epollFD > -1)
+  {
+    struct epoll_event events[SCHEDULER_EVENTS];
+    int count = epoll_wait(m_epollFD, events, SCHEDULER_EVENTS, wait);
+    for(int i = 0; i < count; ++i)
+    {
+      const int fd = events[i].data.fd;
+      if (fd == m_timerFD || fd == m_eventFD)
+      {
+        uint64_t value;
+        if (read(fd, &value, sizeof(value)) == sizeof(value) && fd == m_timerFD)
+          m_armed = 0;
+        continue;
+      }
+
+      /* the handler may have been removed by an earlier one */
+      HandlerMap::iterator handler = m_handlers.find(fd);
+      if (handler != m_handlers.end())
+        handler->second->OnReadable(fd);
+    }
+  }
+  else if (wait != 0)
+    usleep((wait < 0 ? 1000 : wait) * 1000);
+
+  /* collect the runs the workers have finished */
   bool ran = false;
+  if (m_queue)
+  {
+    TaskList done;
+    pthread_mutex_lock(&m_lock);
+    done.swap(m_done);
+    pthread_mutex_unlock(&m_lock);
 
-  for(JobList::iterator it = m_jobs.begin(); it != m_jobs.end(); ++it)
+    for(TaskList::iterator it = done.begin(); it != done.end(); ++it)
+      ran |= Finish(*it);
+  }
+
+  /* start everything that is due, rescheduling each for its next interval */
+  const uint64_t now = Now();
+  while(!m_heap.empty() && m_heap.front().m_due <= now)
   {
-    ISchedulerJob *job = *it;
-    if (job->GetRunTime() > currentTime)
+    std::pop_heap(m_heap.begin(), m_heap.end(), DeadlineLater());
+    Deadline next = m_heap.back();
+    m_heap.pop_back();
+
+    bool run = true;
+    const unsigned int interval = next.m_job->GetDelayInterval();
+    if (interval > 0)
+    {
+      /* the runs whose time has also passed while this one waited */
+      const uint64_t step   = (uint64_t)interval * 1000;
+      uint64_t       missed = (now - next.m_base) / step;
+      uint64_t       lost   = 0;
+      switch(next.m_job->GetCatchUp())
+      {
+        case ISchedulerJob::CATCHUP_ALL:
+          missed = 0;
+          break;
+
+        case ISchedulerJob::CATCHUP_COALESCE:
+          lost = missed;
+          break;
+
+        case ISchedulerJob::CATCHUP_SKIP:
+          run  = missed == 0;
+          lost = run ? 0 : missed + 1;
+          break;
+      }
+
+      const std::string name = next.m_job->GetName();
+      if (lost > 0 && !name.empty())
+        CMetrics::Add("job." + name + ".missed", lost);
+
+      next.m_job->SetRunTime(next.m_job->GetRunTime() + (missed + 1) * interval);
+      next.m_base += (missed + 1) * step;
+      next.m_due   = next.m_base + Jitter(next.m_jitter);
+      m_heap.push_back(next);
+      std::push_heap(m_heap.begin(), m_heap.end(), DeadlineLater());
+    }
+
+    if (!run)
       continue;
 
-    ran = true;
-    job->Execute();
-    job->SetRunTime(job->GetRunTime() + job->GetDelayInterval());
+    Dispatch(next.m_job, now);
+    if (!m_queue)
+    {
+      ran = true;
+      if (interval == 0)
+        Remove(next.m_job);
+    }
   }
 
+  if (m_queue)
+    Expire(now);
+
   return ran;
 }
 
-void CScheduler::AddJob(ISchedulerJob *job)
+void CScheduler::AddJob(ISchedulerJob *job, const unsigned int splay/* = 0 */, const unsigned int jitter/* = 0 */)
 {
   m_jobs.push_back(job);
+
+  /* jobs give their first run as a wall clock time */
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  const int64_t wall  = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  const int64_t delay = (int64_t)job->GetRunTime() * 1000 - wall;
+
+  /* the splay is fixed for the host and job so the spacing is kept on every run */
+  Deadline deadline;
+  deadline.m_base   = Now() + (delay > 0 ? delay : 0);
+  deadline.m_jitter = jitter;
+  deadline.m_job    = job;
+  if (splay > 0)
+    deadline.m_base += HashString(job->GetName(), m_splay) % splay;
+  deadline.m_due    = deadline.m_base + Jitter(jitter);
+  m_heap.push_back(deadline);
+  std::push_heap(m_heap.begin(), m_heap.end(), DeadlineLater());
+}
+
+bool CScheduler::AddFD(const int fd, ISchedulerHandler *handler)
+{
+  if (m_epollFD < 0)
+    return false;
+
+  struct epoll_event ev;
+  ev.events  = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(m_epollFD, EPOLL_CTL_ADD, fd, &ev) < 0)
+    return false;
+
+  m_handlers[fd] = handler;
+  return true;
+}
+
+void CScheduler::RemoveFD(const int fd)
+{
+  if (m_handlers.erase(fd) > 0)
+    epoll_ctl(m_epollFD, EPOLL_CTL_DEL, fd, NULL);
 }
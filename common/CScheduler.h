@@ -21,21 +21,115 @@
 #ifndef _CSCHEDULER_H_
 #define _CSCHEDULER_H_
 
+#include <stdint.h>
+#include <pthread.h>
 #include <ctime>
+#include <string>
 #include <vector>
+#include <map>
+
+#include "CWorkQueue.h"
 
 class ISchedulerJob
 {
   public:
+    /* what to do about runs missed after a suspend or a long blocking job */
+    enum CatchUp
+    {
+      CATCHUP_ALL      = 0, /* run every missed run, back to back           */
+      CATCHUP_COALESCE = 1, /* run once for all the missed runs             */
+      CATCHUP_SKIP     = 2  /* drop the missed runs and wait for the next   */
+    };
+
     ISchedulerJob() {}
     virtual ~ISchedulerJob() {}
 
     virtual std::time_t GetRunTime()  = 0;
     virtual void SetRunTime(std::time_t time) = 0;
     virtual unsigned int GetDelayInterval() = 0;
+
+    /**
+     * Do the job's work, this runs on one of the scheduler's workers if it
+     * has any so it must not touch state the scheduler's thread uses
+     */
     virtual void Execute() = 0;
+
+    /**
+     * Called on the scheduler's thread once Execute has returned, unless
+     * the run timed out
+     */
+    virtual void Complete() {}
+
+    /**
+     * The seconds a run may take from being queued before it is abandoned
+     * and reported as timed out, 0 for no limit
+     */
+    virtual unsigned int GetTimeout() { return 0; }
+
+    /**
+     * The name the job's metrics are kept under, empty for no metrics
+     */
+    virtual std::string GetName() { return std::string(); }
+
+    /**
+     * The policy for runs missed by more than the delay interval, skipped
+     * runs are counted by the job.<name>.missed metric
+     */
+    virtual CatchUp GetCatchUp() { return CATCHUP_COALESCE; }
+
+    /**
+     * Add the names of the CDataCache sources the job reads, they are held
+     * for the whole of each run so it sees one consistent snapshot
+     */
+    virtual void GetDependencies(std::vector<std::string> &deps) {}
+};
+
+/**
+  * The scheduler's time source, it can be replaced to drive the scheduler
+  * from a fake clock
+  */
+class ISchedulerClock
+{
+  public:
+    ISchedulerClock() {}
+    virtual ~ISchedulerClock() {}
+
+    /**
+     * Returns a monotonic time in milliseconds
+     */
+    virtual uint64_t GetTime() = 0;
 };
 
+/**
+  * Receives notice of a file descriptor watched by the scheduler becoming
+  * readable, so other subsystems can share the scheduler's loop
+  */
+class ISchedulerHandler
+{
+  public:
+    ISchedulerHandler() {}
+    virtual ~ISchedulerHandler() {}
+
+    virtual void OnReadable(const int fd) = 0;
+};
+
+/**
+  * Runs recurring jobs from a min-heap of deadlines on CLOCK_MONOTONIC.
+  *
+  * Run blocks in epoll on a timerfd armed for the earliest deadline, and
+  * on any descriptors added with AddFD, so an idle agent does not wake
+  * until there is something to do.
+  *
+  * With workers, due jobs are queued to a thread pool and Run reports
+  * them as they complete. A job is never run again while a previous run
+  * is in progress, and a run past its timeout is abandoned: its worker is
+  * replaced and its result is discarded when it eventually returns.
+  * Jobs with a delay interval of 0 run once and are then deleted.
+  *
+  * So a fleet of agents does not run its jobs in the same second, each
+  * job can be offset by a splay derived from a per-host key, which stays
+  * the same across restarts, and by random jitter chosen for every run.
+  */
 class CScheduler
 {
   public:
@@ -43,21 +137,115 @@ class CScheduler
     ~CScheduler();
 
     /**
-     * Run's any jobs that need running
-     * @return True if any jobs ran
+     * Run jobs on a pool of threads rather than on the thread calling Run,
+     * this must be set before the first Run
+     * @param workers The number of threads, 0 to run jobs from Run
+     */
+    bool SetWorkers(const unsigned int workers);
+
+    /**
+     * Wait for the next job to be due or a watched descriptor to become
+     * readable, then run any jobs that are due
+     * @param timeout The most milliseconds to wait, -1 to wait for the next job
+     * @return True if any jobs completed
+     */
+    bool Run(const int timeout = -1);
+
+    /**
+     * Replace the scheduler's clock, the timerfd is not used with another
+     * clock so Run should be called with a timeout
+     * @param clock The clock, owned by the caller, NULL for CLOCK_MONOTONIC
+     */
+    void SetClock(ISchedulerClock *clock) { m_clock = clock; }
+
+    /**
+     * Set the key the job splay is derived from, such as the hostname,
+     * this must be set before jobs are added
      */
-    bool Run();
+    void SetSplayKey(const std::string &key);
 
     /**
      * Add a recurring job to execute at the specified time
-     * @param job An instance of ISchedulerJob
+     * @param job    An instance of ISchedulerJob
+     * @param splay  The most milliseconds the host's splay may delay the job by
+     * @param jitter The most milliseconds each run may be randomly delayed by
+     */
+    void AddJob(ISchedulerJob *job, const unsigned int splay = 0, const unsigned int jitter = 0);
+
+    /**
+     * Watch a descriptor, the handler is called from Run while it is readable
+     * @param fd      The descriptor, it is not closed by the scheduler
+     * @param handler The handler, owned by the caller
+     */
+    bool AddFD(const int fd, ISchedulerHandler *handler);
+    void RemoveFD(const int fd);
+
+    /**
+     * Returns the CLOCK_MONOTONIC time in milliseconds
      */
-    void AddJob(ISchedulerJob *job);
+    static uint64_t GetTime();
 
   private:
-    typedef std::vector<ISchedulerJob *> JobList;
+    struct Deadline
+    {
+      uint64_t       m_due;    /* CLOCK_MONOTONIC milliseconds */
+      uint64_t       m_base;   /* the due time before jitter */
+      unsigned int   m_jitter;
+      ISchedulerJob *m_job;
+    };
+
+    struct DeadlineLater
+    {
+      bool operator()(const Deadline &a, const Deadline &b) const { return a.m_due > b.m_due; }
+    };
+
+    struct Task
+    {
+      ISchedulerJob *m_job;
+      uint64_t       m_queued;    /* milliseconds */
+      uint64_t       m_started;   /* milliseconds, under m_lock */
+      uint64_t       m_finished;  /* milliseconds, under m_lock */
+      bool           m_abandoned; /* under m_lock */
+    };
+
+    typedef std::vector<ISchedulerJob *>          JobList;
+    typedef std::vector<Deadline>                 DeadlineHeap;
+    typedef std::map<int, ISchedulerHandler *>    HandlerMap;
+    typedef std::map<ISchedulerJob *, Task *>     TaskMap;
+    typedef std::vector<Task *>                   TaskList;
+    typedef CWorkQueue<Task *>                    TaskQueue;
+
+    JobList          m_jobs;
+    DeadlineHeap     m_heap;
+    HandlerMap       m_handlers;
+    int              m_epollFD;
+    int              m_timerFD;
+    uint64_t         m_armed;   /* the deadline the timer is set for, 0 if none */
+    ISchedulerClock *m_clock;
+    uint64_t         m_splay;   /* hash of the splay key */
+    unsigned int     m_seed;
+
+    TaskQueue       *m_queue;   /* NULL to run jobs from Run */
+    TaskMap          m_running; /* jobs queued or running on a worker */
+    int              m_eventFD; /* signalled by the workers as jobs finish */
+    pthread_mutex_t  m_lock;
+    pthread_cond_t   m_idle;
+    TaskList         m_done;    /* under m_lock */
+    unsigned int     m_live;    /* workers running, under m_lock */
+    unsigned int     m_stuck;   /* workers in abandoned jobs, under m_lock */
+    unsigned int     m_surplus; /* workers to retire, under m_lock */
+
+    void Arm     (const uint64_t due);
+    void Dispatch(ISchedulerJob *job, const uint64_t now);
+    bool Finish  (Task *task);
+    void Expire  (const uint64_t now);
+    void Remove  (ISchedulerJob *job);
+    bool StartWorker();
+    static void Execute(ISchedulerJob *job);
+    unsigned int Jitter(const unsigned int jitter);
+    uint64_t     Now   ();
 
-    JobList m_jobs;
+    static void *WorkerThread(void *arg);
 };
 
 #endif // _CSCHEDULER_H_
@@ -0,0 +1,435 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CSpool.h"
+#include "CMetrics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "zlib.h"
+
+/* the file header holds the head so replayed records can be dropped in place */
+#define SPOOL_MAGIC   "ARSP"
+#define SPOOL_VERSION 1
+#define SPOOL_HEADER  16
+
+/* each record is its header, body, signature and a CRC32 of the body and signature */
+#define RECORD_MAGIC  "ARSR"
+#define RECORD_HEADER 18
+
+/* the size of the blocks records are checked and copied in */
+#define SPOOL_BLOCK 65536
+
+/* the spool is always stored in LE */
+static void PutLE(unsigned char *buffer, uint64_t value, const size_t size)
+{
+  for(size_t i = 0; i < size; ++i, value >>= 8)
+    buffer[i] = value & 0xFF;
+}
+
+static uint64_t GetLE(const unsigned char *buffer, const size_t size)
+{
+  uint64_t value = 0;
+  for(size_t i = size; i > 0; --i)
+    value = (value << 8) | buffer[i-1];
+  return value;
+}
+
+static bool WriteAt(const int fd, const void *buffer, const size_t length, const uint64_t offset)
+{
+  size_t done = 0;
+  while(done < length)
+  {
+    ssize_t ret = pwrite(fd, (const char *)buffer + done, length - done, offset + done);
+    if (ret <= 0)
+      return false;
+    done += ret;
+  }
+  return true;
+}
+
+static bool ReadAt(const int fd, void *buffer, const size_t length, const uint64_t offset)
+{
+  size_t done = 0;
+  while(done < length)
+  {
+    ssize_t ret = pread(fd, (char *)buffer + done, length - done, offset + done);
+    if (ret <= 0)
+      return false;
+    done += ret;
+  }
+  return true;
+}
+
+CSpool::CSpool() :
+  m_fd     (-1          ),
+  m_cap    (0           ),
+  m_head   (SPOOL_HEADER),
+  m_end    (SPOOL_HEADER),
+  m_writing(false       ),
+  m_failed (false       ),
+  m_length (0           ),
+  m_crc    (0           )
+{
+}
+
+CSpool::~CSpool()
+{
+  Close();
+}
+
+bool CSpool::Open(const std::string &path, const uint64_t cap)
+{
+  Close();
+
+  m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (m_fd < 0)
+    return false;
+
+  m_path = path;
+  m_cap  = cap;
+  if (!Load())
+  {
+    Close();
+    return false;
+  }
+
+  /* the cap may have been lowered since the records were spooled */
+  Evict();
+  Update();
+  return true;
+}
+
+void CSpool::Close()
+{
+  if (m_fd < 0)
+    return;
+
+  Abort();
+  close(m_fd);
+  m_fd = -1;
+  m_records.clear();
+  m_head = m_end = SPOOL_HEADER;
+}
+
+uint64_t CSpool::GetSize() const
+{
+  return m_end - m_head;
+}
+
+bool CSpool::Load()
+{
+  struct stat st;
+  if (fstat(m_fd, &st) != 0)
+    return false;
+
+  /* start a new spool if there is not a valid one */
+  unsigned char header[SPOOL_HEADER];
+  if (
+    (uint64_t)st.st_size < SPOOL_HEADER ||
+    !ReadAt(m_fd, header, sizeof(header), 0) ||
+    memcmp(header, SPOOL_MAGIC, 4) != 0 ||
+    GetLE(header + 4, 4) != SPOOL_VERSION)
+  {
+    memcpy(header, SPOOL_MAGIC, 4);
+    PutLE(header + 4, SPOOL_VERSION, 4);
+    PutLE(header + 8, SPOOL_HEADER , 8);
+    if (ftruncate(m_fd, 0) != 0 || !WriteAt(m_fd, header, sizeof(header), 0))
+      return false;
+    st.st_size = SPOOL_HEADER;
+  }
+
+  const uint64_t size = st.st_size;
+  m_head = GetLE(header + 8, 8);
+  if (m_head < SPOOL_HEADER || m_head > size)
+    m_head = SPOOL_HEADER;
+
+  /* index the records, stopping at the first that is torn */
+  uint64_t offset = m_head;
+  char    *block  = new char[SPOOL_BLOCK];
+  while(offset + RECORD_HEADER <= size)
+  {
+    unsigned char rec[RECORD_HEADER];
+    if (!ReadAt(m_fd, rec, sizeof(rec), offset) || memcmp(rec, RECORD_MAGIC, 4) != 0)
+      break;
+
+    Record record;
+    record.m_offset = offset + RECORD_HEADER;
+    record.m_time   = GetLE(rec + 4 , 8);
+    record.m_length = GetLE(rec + 12, 4);
+    const size_t siglen = GetLE(rec + 16, 2);
+
+    const uint64_t next = record.m_offset + record.m_length + siglen + 4;
+    if (next > size)
+      break;
+
+    uint32_t crc = crc32(0L, Z_NULL, 0);
+    bool     ok  = true;
+    for(uint64_t pos = record.m_offset; ok && pos < next - 4;)
+    {
+      size_t len = next - 4 - pos;
+      if (len > SPOOL_BLOCK)
+        len = SPOOL_BLOCK;
+
+      ok   = ReadAt(m_fd, block, len, pos);
+      crc  = crc32(crc, (const Bytef *)block, len);
+      pos += len;
+    }
+
+    unsigned char tail[4];
+    if (!ok || !ReadAt(m_fd, tail, sizeof(tail), next - 4) || GetLE(tail, 4) != crc)
+      break;
+
+    record.m_signature.resize(siglen);
+    if (siglen > 0 && !ReadAt(m_fd, &record.m_signature[0], siglen, record.m_offset + record.m_length))
+      break;
+
+    m_records.push_back(record);
+    offset = next;
+  }
+  delete[] block;
+
+  /* cut off anything after the last good record */
+  m_end = offset;
+  if (m_end < size)
+  {
+    fprintf(stderr, "CSpool::Load - Dropped a torn record from %s\n", m_path.c_str());
+    if (ftruncate(m_fd, m_end) != 0)
+      return false;
+  }
+
+  return true;
+}
+
+bool CSpool::Begin()
+{
+  if (m_fd < 0)
+    return false;
+
+  Abort();
+
+  /* the header is written by Commit, until then the record is torn */
+  unsigned char rec[RECORD_HEADER];
+  memset(rec, 0, sizeof(rec));
+  if (!WriteAt(m_fd, rec, sizeof(rec), m_end))
+    return false;
+
+  m_writing = true;
+  m_failed  = false;
+  m_length  = 0;
+  m_crc     = crc32(0L, Z_NULL, 0);
+  return true;
+}
+
+bool CSpool::Append(const char *data, const size_t length)
+{
+  if (!m_writing || m_failed)
+    return false;
+
+  if (!WriteAt(m_fd, data, length, m_end + RECORD_HEADER + m_length))
+  {
+    m_failed = true;
+    return false;
+  }
+
+  m_crc     = crc32(m_crc, (const Bytef *)data, length);
+  m_length += length;
+  return true;
+}
+
+bool CSpool::Commit(const std::string &signature)
+{
+  if (!m_writing || m_failed || signature.length() > 0xFFFF)
+  {
+    Abort();
+    return false;
+  }
+
+  Record record;
+  record.m_offset    = m_end + RECORD_HEADER;
+  record.m_time      = time(NULL);
+  record.m_length    = m_length;
+  record.m_signature = signature;
+
+  const uint32_t crc = crc32(m_crc, (const Bytef *)signature.c_str(), signature.length());
+  unsigned char tail[4];
+  PutLE(tail, crc, 4);
+
+  unsigned char rec[RECORD_HEADER];
+  memcpy(rec, RECORD_MAGIC, 4);
+  PutLE(rec + 4 , record.m_time     , 8);
+  PutLE(rec + 12, record.m_length   , 4);
+  PutLE(rec + 16, signature.length(), 2);
+
+  const uint64_t sigAt = record.m_offset + record.m_length;
+  if (
+    !WriteAt(m_fd, signature.c_str(), signature.length(), sigAt) ||
+    !WriteAt(m_fd, tail, sizeof(tail), sigAt + signature.length()) ||
+    !WriteAt(m_fd, rec , sizeof(rec ), m_end) ||
+    fdatasync(m_fd) != 0)
+  {
+    Abort();
+    return false;
+  }
+
+  m_writing = false;
+  m_end     = sigAt + signature.length() + sizeof(tail);
+  m_records.push_back(record);
+  CMetrics::Add("spool.spooled", 1);
+
+  Evict();
+  Update();
+  return true;
+}
+
+void CSpool::Abort()
+{
+  if (!m_writing)
+    return;
+
+  /* drop what was written of the record */
+  m_writing = false;
+  if (ftruncate(m_fd, m_end) != 0)
+    fprintf(stderr, "CSpool::Abort - Failed to truncate %s\n", m_path.c_str());
+}
+
+bool CSpool::Peek(Record &record) const
+{
+  if (m_records.empty())
+    return false;
+
+  record = m_records.front();
+  return true;
+}
+
+bool CSpool::Read(const Record &record, const uint32_t offset, char *buffer, const size_t length)
+{
+  if (m_fd < 0 || (uint64_t)offset + length > record.m_length)
+    return false;
+  return ReadAt(m_fd, buffer, length, record.m_offset + offset);
+}
+
+bool CSpool::Pop()
+{
+  if (m_records.empty())
+    return false;
+
+  const Record &record = m_records.front();
+  const uint64_t next  = record.m_offset + record.m_length + record.m_signature.length() + 4;
+  m_records.pop_front();
+
+  const bool ret = SetHead(m_records.empty() ? m_end : next);
+  Update();
+  return ret;
+}
+
+bool CSpool::SetHead(const uint64_t head)
+{
+  m_head = head;
+
+  /* once every record is replayed the file can simply be emptied */
+  if (m_records.empty() && !m_writing)
+  {
+    m_head = m_end = SPOOL_HEADER;
+    if (ftruncate(m_fd, m_end) != 0)
+      return false;
+  }
+  else if (!m_writing && m_head - SPOOL_HEADER > (m_end - SPOOL_HEADER) / 2)
+    return Compact();
+
+  unsigned char buffer[8];
+  PutLE(buffer, m_head, 8);
+  return WriteAt(m_fd, buffer, sizeof(buffer), 8) && fdatasync(m_fd) == 0;
+}
+
+bool CSpool::Compact()
+{
+  /* copy the live records to a new file and swap it in */
+  const std::string tmp = m_path + ".tmp";
+  int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (fd < 0)
+    return false;
+
+  unsigned char header[SPOOL_HEADER];
+  memcpy(header, SPOOL_MAGIC, 4);
+  PutLE(header + 4, SPOOL_VERSION, 4);
+  PutLE(header + 8, SPOOL_HEADER , 8);
+
+  bool  ok    = WriteAt(fd, header, sizeof(header), 0);
+  char *block = new char[SPOOL_BLOCK];
+  for(uint64_t pos = m_head; ok && pos < m_end;)
+  {
+    size_t len = m_end - pos;
+    if (len > SPOOL_BLOCK)
+      len = SPOOL_BLOCK;
+
+    ok   = ReadAt (m_fd, block, len, pos) &&
+           WriteAt(fd  , block, len, pos - m_head + SPOOL_HEADER);
+    pos += len;
+  }
+  delete[] block;
+
+  if (!ok || fdatasync(fd) != 0 || rename(tmp.c_str(), m_path.c_str()) != 0)
+  {
+    close (fd);
+    unlink(tmp.c_str());
+    return false;
+  }
+
+  close(m_fd);
+  m_fd = fd;
+
+  const uint64_t shift = m_head - SPOOL_HEADER;
+  for(RecordList::iterator it = m_records.begin(); it != m_records.end(); ++it)
+    it->m_offset -= shift;
+  m_head  = SPOOL_HEADER;
+  m_end  -= shift;
+  return true;
+}
+
+void CSpool::Evict()
+{
+  if (m_writing || GetSize() <= m_cap)
+    return;
+
+  /* drop the oldest records until the rest fit */
+  uint64_t evicted = 0;
+  uint64_t head    = m_head;
+  while(!m_records.empty() && m_end - head > m_cap)
+  {
+    const Record &record = m_records.front();
+    head = record.m_offset + record.m_length + record.m_signature.length() + 4;
+    m_records.pop_front();
+    ++evicted;
+  }
+
+  CMetrics::Add("spool.evicted", evicted);
+  SetHead(m_records.empty() ? m_end : head);
+}
+
+void CSpool::Update()
+{
+  CMetrics::Set("spool.records", m_records.size());
+  CMetrics::Set("spool.bytes"  , GetSize());
+}
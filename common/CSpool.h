@@ -0,0 +1,115 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CSPOOL_H_
+#define _CSPOOL_H_
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+
+/**
+  * An append only file of signed messages that could not be sent, kept
+  * so they can be replayed in order once the server is reachable again.
+  *
+  * A record is written as the message is produced and only made durable
+  * by Commit, which syncs it to disk. A record torn by a crash fails its
+  * checksum and is cut off when the spool is next opened.
+  *
+  * Replayed records are dropped from the front by moving the head, which
+  * is kept in the file's header. When the records outgrow the cap the
+  * oldest are evicted, and the space before the head is reclaimed by
+  * rewriting the file once it is more than half of it.
+  */
+class CSpool
+{
+  public:
+    struct Record
+    {
+      uint64_t    m_offset;    /* of the body in the file */
+      uint64_t    m_time;      /* when it was spooled, seconds since the epoch */
+      uint32_t    m_length;    /* of the body */
+      std::string m_signature;
+    };
+
+    CSpool();
+    ~CSpool();
+
+    /**
+      * Open or create the spool, dropping any torn record at its end
+      * @param path The spool file
+      * @param cap  The most bytes of records to keep
+      */
+    bool Open(const std::string &path, const uint64_t cap);
+    void Close();
+    bool IsOpen() const { return m_fd >= 0; }
+
+    bool     IsEmpty () const { return m_records.empty(); }
+    size_t   GetCount() const { return m_records.size();  }
+    uint64_t GetSize () const;
+
+    /**
+      * Write a record, its body is appended a block at a time and it is
+      * not kept until it is committed
+      */
+    bool Begin ();
+    bool Append(const char *data, const size_t length);
+    bool Commit(const std::string &signature);
+    void Abort ();
+
+    /**
+      * Returns the oldest record
+      */
+    bool Peek(Record &record) const;
+
+    /**
+      * Read part of a record's body
+      * @param offset The offset into the body
+      */
+    bool Read(const Record &record, const uint32_t offset, char *buffer, const size_t length);
+
+    /**
+      * Drop the oldest record once it has been replayed
+      */
+    bool Pop();
+
+  private:
+    typedef std::deque<Record> RecordList;
+
+    int          m_fd;
+    std::string  m_path;
+    uint64_t     m_cap;
+    RecordList   m_records;
+    uint64_t     m_head;    /* offset of the oldest record */
+    uint64_t     m_end;     /* offset after the newest record */
+
+    bool         m_writing; /* a record has been begun */
+    bool         m_failed;  /* an append of the record failed */
+    uint32_t     m_length;  /* of the record's body so far */
+    uint32_t     m_crc;     /* of the record's body so far */
+
+    bool Load   ();
+    bool SetHead(const uint64_t head);
+    bool Compact();
+    void Evict  ();
+    void Update ();
+};
+
+#endif // _CSPOOL_H_
@@ -0,0 +1,136 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CWORKQUEUE_H_
+#define _CWORKQUEUE_H_
+
+#include <pthread.h>
+#include <deque>
+
+/**
+  * A bounded FIFO shared between producer and consumer threads
+  */
+template <typename T>
+class CWorkQueue
+{
+  public:
+    CWorkQueue(const size_t capacity) :
+      m_capacity(capacity > 0 ? capacity : 1),
+      m_closed  (false)
+    {
+      pthread_mutex_init(&m_lock    , NULL);
+      pthread_cond_init (&m_notEmpty, NULL);
+      pthread_cond_init (&m_notFull , NULL);
+    }
+
+    ~CWorkQueue()
+    {
+      pthread_cond_destroy (&m_notFull );
+      pthread_cond_destroy (&m_notEmpty);
+      pthread_mutex_destroy(&m_lock    );
+    }
+
+    /**
+      * Append an item, blocking while the queue is full
+      * @return false if the queue has been closed
+      */
+    bool Push(const T &item)
+    {
+      pthread_mutex_lock(&m_lock);
+      while(m_queue.size() >= m_capacity && !m_closed)
+        pthread_cond_wait(&m_notFull, &m_lock);
+
+      if (m_closed)
+      {
+        pthread_mutex_unlock(&m_lock);
+        return false;
+      }
+
+      m_queue.push_back(item);
+      pthread_cond_signal (&m_notEmpty);
+      pthread_mutex_unlock(&m_lock);
+      return true;
+    }
+
+    /**
+      * Remove the next item, blocking while the queue is empty
+      * @return false once the queue is closed and drained
+      */
+    bool Pop(T &item)
+    {
+      pthread_mutex_lock(&m_lock);
+      while(m_queue.empty() && !m_closed)
+        pthread_cond_wait(&m_notEmpty, &m_lock);
+
+      if (m_queue.empty())
+      {
+        pthread_mutex_unlock(&m_lock);
+        return false;
+      }
+
+      item = m_queue.front();
+      m_queue.pop_front();
+      pthread_cond_signal (&m_notFull);
+      pthread_mutex_unlock(&m_lock);
+      return true;
+    }
+
+    /**
+      * Remove the next item if there is one, without blocking
+      * @return false if the queue is empty
+      */
+    bool TryPop(T &item)
+    {
+      pthread_mutex_lock(&m_lock);
+      if (m_queue.empty())
+      {
+        pthread_mutex_unlock(&m_lock);
+        return false;
+      }
+
+      item = m_queue.front();
+      m_queue.pop_front();
+      pthread_cond_signal (&m_notFull);
+      pthread_mutex_unlock(&m_lock);
+      return true;
+    }
+
+    /**
+      * Stop accepting new items, consumers will drain what is left
+      */
+    void Close()
+    {
+      pthread_mutex_lock    (&m_lock    );
+      m_closed = true;
+      pthread_cond_broadcast(&m_notEmpty);
+      pthread_cond_broadcast(&m_notFull );
+      pthread_mutex_unlock  (&m_lock    );
+    }
+
+  private:
+    pthread_mutex_t m_lock;
+    pthread_cond_t  m_notEmpty;
+    pthread_cond_t  m_notFull;
+    std::deque<T>   m_queue;
+    size_t          m_capacity;
+    bool            m_closed;
+};
+
+#endif // _CWORKQUEUE_H_
@@ -0,0 +1,341 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CBaselineReader.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+CBaselineReader::CBaselineReader() :
+  m_input  (NULL),
+  m_fd     (-1  ),
+  m_map    (NULL),
+  m_mapSize(0   ),
+  m_offset (0   ),
+  m_error  (false),
+  m_pending(false)
+{
+  Close();
+}
+
+CBaselineReader::~CBaselineReader()
+{
+  Close();
+}
+
+bool CBaselineReader::Open(std::istream &input)
+{
+  Close();
+  if (!input.good())
+    return false;
+
+  m_input = &input;
+  return ReadHeader();
+}
+
+bool CBaselineReader::Open(const std::string &file)
+{
+  Close();
+
+  m_fd = open(file.c_str(), O_RDONLY);
+  if (m_fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(m_fd, &st) < 0)
+  {
+    Close();
+    return false;
+  }
+
+  /* an empty baseline is valid but can't be mapped */
+  m_mapSize = st.st_size;
+  if (m_mapSize == 0)
+    return true;
+
+  void *map = mmap(NULL, m_mapSize, PROT_READ, MAP_PRIVATE, m_fd, 0);
+  if (map == MAP_FAILED)
+  {
+    Close();
+    return false;
+  }
+
+  m_map = (const unsigned char *)map;
+  madvise(map, m_mapSize, MADV_SEQUENTIAL);
+
+  if (m_mapSize >= BASELINE_HEADER_SIZE && memcmp(m_map, BASELINE_MAGIC, 4) == 0)
+  {
+    if (!ParseHeader(m_map))
+    {
+      Close();
+      return false;
+    }
+    m_offset = BASELINE_HEADER_SIZE;
+
+    if (m_version >= 2)
+    {
+      if (m_mapSize < m_offset + BASELINE_SHARD_SIZE || !ParseShard(m_map + m_offset))
+      {
+        Close();
+        return false;
+      }
+      m_offset += BASELINE_SHARD_SIZE;
+    }
+  }
+
+  return true;
+}
+
+void CBaselineReader::Close()
+{
+  if (m_map)
+    munmap((void *)m_map, m_mapSize);
+
+  if (m_fd > -1)
+    close(m_fd);
+
+  m_input   = NULL;
+  m_fd      = -1;
+  m_map     = NULL;
+  m_mapSize = 0;
+  m_offset  = 0;
+  m_error   = false;
+
+  /* until we see a header assume a version 0 MD5 baseline */
+  m_version    = 0;
+  m_type       = IHashEngine::HT_MD5;
+  m_digestLen  = 16;
+  m_shardIndex = 0;
+  m_shardCount = 1;
+  m_pending    = false;
+  m_pathLen    = 0;
+}
+
+bool CBaselineReader::ParseHeader(const unsigned char *header)
+{
+  if (header[4] < 1 || header[4] > BASELINE_VERSION)
+    return false;
+
+  if (header[5] >= IHashEngine::HT_COUNT || header[6] == 0 || header[6] > HASH_MAX_DIGEST)
+    return false;
+
+  m_version   = header[4];
+  m_type      = (IHashEngine::Type)header[5];
+  m_digestLen = header[6];
+  return true;
+}
+
+bool CBaselineReader::ParseShard(const unsigned char *shard)
+{
+  m_shardIndex = shard[0] | (shard[1] << 8);
+  m_shardCount = shard[2] | (shard[3] << 8);
+  return m_shardCount > 0 && m_shardIndex < m_shardCount;
+}
+
+bool CBaselineReader::ReadHeader()
+{
+  unsigned char header[BASELINE_HEADER_SIZE];
+  m_input->read((char *)header, 2);
+  if (m_input->gcount() == 0)
+    return true;
+
+  if (m_input->gcount() < 2)
+    return false;
+
+  /*
+   * A version 0 baseline starts with a path length, "AF" as a length would
+   * have to be followed by a path starting with '/' rather than "SB"
+   */
+  if (memcmp(header, BASELINE_MAGIC, 2) != 0)
+  {
+    m_pending = true;
+    memcpy(m_pendingLen, header, 2);
+    return true;
+  }
+
+  m_input->read((char *)header + 2, BASELINE_HEADER_SIZE - 2);
+  if (m_input->gcount() < BASELINE_HEADER_SIZE - 2)
+    return false;
+
+  if (memcmp(header, BASELINE_MAGIC, 4) != 0 || !ParseHeader(header))
+    return false;
+
+  if (m_version < 2)
+    return true;
+
+  unsigned char shard[BASELINE_SHARD_SIZE];
+  m_input->read((char *)shard, sizeof(shard));
+  if (m_input->gcount() < (std::streamsize)sizeof(shard))
+    return false;
+
+  return ParseShard(shard);
+}
+
+bool CBaselineReader::Next(Record &record)
+{
+  if (m_error)
+    return false;
+
+  if (m_version >= 3)
+    return NextFront(record);
+
+  if (m_input)
+    return NextStream(record);
+
+  return NextMapped(record);
+}
+
+bool CBaselineReader::NextStream(Record &record)
+{
+  /* lengths are always stored in LE */
+  unsigned char len[2];
+  if (m_pending)
+  {
+    memcpy(len, m_pendingLen, sizeof(len));
+    m_pending = false;
+  }
+  else
+  {
+    m_input->read((char *)len, sizeof(len));
+    if (m_input->gcount() == 0)
+      return false;
+
+    if (m_input->gcount() < (std::streamsize)sizeof(len))
+    {
+      m_error = true;
+      return false;
+    }
+  }
+
+  const size_t length = len[0] | (len[1] << 8);
+  m_input->read(m_path, length);
+  if (m_input->gcount() < (std::streamsize)length)
+  {
+    m_error = true;
+    return false;
+  }
+
+  m_input->read((char *)m_digest, m_digestLen);
+  if (m_input->gcount() < (std::streamsize)m_digestLen)
+  {
+    m_error = true;
+    return false;
+  }
+
+  record.m_path    = m_path;
+  record.m_pathLen = length;
+  record.m_digest  = m_digest;
+  return true;
+}
+
+bool CBaselineReader::NextMapped(Record &record)
+{
+  if (m_offset == m_mapSize)
+    return false;
+
+  if (m_mapSize - m_offset < 2)
+  {
+    m_error = true;
+    return false;
+  }
+
+  const size_t length = m_map[m_offset] | (m_map[m_offset + 1] << 8);
+  if (m_mapSize - m_offset - 2 < length + m_digestLen)
+  {
+    m_error = true;
+    return false;
+  }
+
+  record.m_path    = (const char *)m_map + m_offset + 2;
+  record.m_pathLen = length;
+  record.m_digest  = m_map + m_offset + 2 + length;
+  m_offset += 2 + length + m_digestLen;
+  return true;
+}
+
+bool CBaselineReader::NextFront(Record &record)
+{
+  /* the baseline may only end between records */
+  if (m_input ? m_input->peek() == EOF : m_offset == m_mapSize)
+    return false;
+
+  size_t shared, suffix;
+  if (!ReadVarint(shared) || !ReadVarint(suffix) ||
+      shared > m_pathLen || suffix > sizeof(m_path) - shared ||
+      !ReadBytes(m_path + shared, suffix) ||
+      !ReadBytes(m_digest, m_digestLen))
+  {
+    m_error = true;
+    return false;
+  }
+
+  m_pathLen        = shared + suffix;
+  record.m_path    = m_path;
+  record.m_pathLen = m_pathLen;
+  record.m_digest  = m_digest;
+  return true;
+}
+
+bool CBaselineReader::ReadVarint(size_t &value)
+{
+  value = 0;
+  for(unsigned int shift = 0; shift < 32; shift += 7)
+  {
+    int c;
+    if (m_input)
+    {
+      if ((c = m_input->get()) == EOF)
+        return false;
+    }
+    else
+    {
+      if (m_offset == m_mapSize)
+        return false;
+      c = m_map[m_offset++];
+    }
+
+    value |= (size_t)(c & 0x7F) << shift;
+    if (!(c & 0x80))
+      return true;
+  }
+
+  return false;
+}
+
+bool CBaselineReader::ReadBytes(void *buffer, const size_t length)
+{
+  if (m_input)
+  {
+    m_input->read((char *)buffer, length);
+    return m_input->gcount() == (std::streamsize)length;
+  }
+
+  if (m_mapSize - m_offset < length)
+    return false;
+
+  memcpy(buffer, m_map + m_offset, length);
+  m_offset += length;
+  return true;
+}
@@ -0,0 +1,121 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CBASELINEREADER_H_
+#define _CBASELINEREADER_H_
+
+#include <stdint.h>
+#include <string>
+#include <istream>
+
+#include "IHashEngine.h"
+
+/*
+ * Baselines start with a header of the magic, the format version, the
+ * hash engine type and the digest length. Baselines from before the
+ * header was introduced are version 0 and always MD5. Version 2 adds
+ * the shard the baseline covers as LE uint16 index and count.
+ *
+ * Up to version 2 each record is the path as a LE uint16 length and the
+ * path, followed by the digest. Version 3 front codes the sorted paths,
+ * each record is the length of the prefix shared with the previous path
+ * and the length of the rest as LEB128 varints, the rest of the path and
+ * then the digest.
+ */
+#define BASELINE_MAGIC       "AFSB"
+#define BASELINE_VERSION     3
+#define BASELINE_HEADER_SIZE 7
+#define BASELINE_SHARD_SIZE  4
+
+/**
+  * Reads the records of a saved FSCHECK baseline one at a time, either
+  * from a stream or directly out of a memory mapped file
+  */
+class CBaselineReader
+{
+  public:
+    struct Record
+    {
+      const char          *m_path;
+      size_t               m_pathLen;
+      const unsigned char *m_digest;
+    };
+
+    CBaselineReader();
+    ~CBaselineReader();
+
+    bool Open(std::istream &input);
+    bool Open(const std::string &file);
+    void Close();
+
+    /**
+      * Read the next record, the pointers are valid until the next call
+      * @return false at the end of the baseline or on error
+      */
+    bool Next(Record &record);
+
+    /**
+      * Returns true if Next stopped due to a malformed baseline
+      */
+    bool IsError() const { return m_error; }
+
+    unsigned int      GetVersion     () const { return m_version  ; }
+    IHashEngine::Type GetType        () const { return m_type     ; }
+    size_t            GetDigestLength() const { return m_digestLen; }
+
+    /**
+      * Returns the shard of the protected files the baseline covers,
+      * baselines before version 2 are always shard 0 of 1
+      */
+    unsigned int      GetShardIndex  () const { return m_shardIndex; }
+    unsigned int      GetShardCount  () const { return m_shardCount; }
+
+  private:
+    std::istream        *m_input;
+    int                  m_fd;
+    const unsigned char *m_map;
+    size_t               m_mapSize;
+    size_t               m_offset;
+    bool                 m_error;
+
+    unsigned int         m_version;
+    IHashEngine::Type    m_type;
+    size_t               m_digestLen;
+    unsigned int         m_shardIndex;
+    unsigned int         m_shardCount;
+
+    /* record storage when reading from a stream */
+    bool                 m_pending;
+    unsigned char        m_pendingLen[2];
+    size_t               m_pathLen; /* the previous path, front coded records share its prefix */
+    char                 m_path[UINT16_MAX];
+    unsigned char        m_digest[HASH_MAX_DIGEST];
+
+    bool ParseHeader(const unsigned char *header);
+    bool ParseShard (const unsigned char *shard);
+    bool ReadHeader ();
+    bool NextStream (Record &record);
+    bool NextMapped(Record &record);
+    bool NextFront (Record &record);
+    bool ReadVarint(size_t &value);
+    bool ReadBytes (void *buffer, const size_t length);
+};
+
+#endif // _CBASELINEREADER_H_
@@ -0,0 +1,94 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CDirReader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/* the kernel's record, older glibc does not declare it */
+struct linux_dirent64
+{
+  uint64_t       d_ino;
+  int64_t        d_off;
+  unsigned short d_reclen;
+  unsigned char  d_type;
+  char           d_name[1];
+};
+
+CDirReader::CDirReader(const size_t bufferSize) :
+  m_size (bufferSize),
+  m_pos  (0),
+  m_len  (0),
+  m_fd   (-1),
+  m_calls(0)
+{
+  m_buffer = (char *)malloc(m_size);
+}
+
+CDirReader::~CDirReader()
+{
+  free(m_buffer);
+}
+
+void CDirReader::Open(const int fd)
+{
+  m_fd  = fd;
+  m_pos = 0;
+  m_len = 0;
+}
+
+bool CDirReader::Next(Entry &entry)
+{
+  if (!m_buffer || m_fd < 0)
+    return false;
+
+  for(;;)
+  {
+    if (m_pos >= m_len)
+    {
+      ++m_calls;
+      long ret = syscall(SYS_getdents64, m_fd, m_buffer, m_size);
+      if (ret <= 0)
+      {
+        m_fd = -1;
+        return false;
+      }
+
+      m_len = ret;
+      m_pos = 0;
+    }
+
+    struct linux_dirent64 *dent = (struct linux_dirent64 *)(m_buffer + m_pos);
+    m_pos += dent->d_reclen;
+
+    const char *name = dent->d_name;
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      continue;
+
+    entry.m_ino     = dent->d_ino;
+    entry.m_type    = dent->d_type;
+    entry.m_name    = name;
+    entry.m_nameLen = strlen(name);
+    return true;
+  }
+}
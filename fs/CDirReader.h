@@ -0,0 +1,70 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CDIRREADER_H_
+#define _CDIRREADER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+  * Reads directory entries straight from getdents64 into a large buffer,
+  * avoiding the small reads and per entry copies of readdir
+  */
+class CDirReader
+{
+  public:
+    struct Entry
+    {
+      uint64_t      m_ino;
+      unsigned char m_type;    /* DT_* as reported by the filesystem, may be DT_UNKNOWN */
+      const char   *m_name;    /* valid until the next call to Next */
+      size_t        m_nameLen;
+    };
+
+    CDirReader(const size_t bufferSize = 256 * 1024);
+    ~CDirReader();
+
+    /**
+      * Start reading a directory, the descriptor is not closed by the reader
+      */
+    void Open(const int fd);
+
+    /**
+      * Fetch the next entry, "." and ".." are skipped
+      * @return False at the end of the directory or on error
+      */
+    bool Next(Entry &entry);
+
+    /**
+      * Returns the number of getdents64 calls made
+      */
+    uint64_t GetCalls() { return m_calls; }
+
+  private:
+    char    *m_buffer;
+    size_t   m_size;
+    size_t   m_pos;
+    size_t   m_len;
+    int      m_fd;
+    uint64_t m_calls;
+};
+
+#endif // _CDIRREADER_H_
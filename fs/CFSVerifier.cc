@@ -21,8 +21,7 @@
 #include "CFSVerifier.h"
 #include "common/CCommon.h"
 #include "common/CCompress.h"
-
-#include "polarssl/md5.h"
+#include "CHashFactory.h"
 
 #include <stdint.h>
 #include <stdio.h>
@@ -32,23 +31,364 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/inotify.h>
+#include <sys/fanotify.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
 
 #include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <set>
+
+/* how many pending files each hashing thread may have queued */
+#define SCAN_QUEUE_DEPTH 64
+
+/* inotify events that mean a directory's contents changed, or it went away */
+#define MONITOR_INOTIFY_MASK \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+/* stat cache file header */
+#define CACHE_MAGIC   "AFSC"
+#define CACHE_VERSION 2
+
+/* marks an interrupted scan, kept beside the stat cache */
+#define CHECKPOINT_SUFFIX  ".ckpt"
+#define CHECKPOINT_MAGIC   "AFSR"
+#define CHECKPOINT_VERSION 1
+
+/* tree summary header, laid out as the baseline header */
+#define TREE_MAGIC   "AFST"
+#define TREE_VERSION 2
+
+/* the cache is always stored in LE */
+static void WriteLE(std::ostream &output, uint64_t value, const size_t size)
+{
+  unsigned char buffer[8];
+  for(size_t i = 0; i < size; ++i, value >>= 8)
+    buffer[i] = value & 0xFF;
+  output.write((const char *)buffer, size);
+}
+
+static bool ReadLE(std::istream &input, uint64_t &value, const size_t size)
+{
+  unsigned char buffer[8];
+  input.read((char *)buffer, size);
+  if (input.gcount() < (std::streamsize)size)
+    return false;
+
+  value = 0;
+  for(size_t i = size; i > 0; --i)
+    value = (value << 8) | buffer[i-1];
+  return true;
+}
+
+/* LEB128, for the lengths in front coded baselines */
+static void WriteVarint(std::ostream &output, uint64_t value)
+{
+  unsigned char buffer[10];
+  size_t        len = 0;
+  do
+  {
+    buffer[len] = value & 0x7F;
+    if (value >>= 7)
+      buffer[len] |= 0x80;
+    ++len;
+  }
+  while(value);
+  output.write((const char *)buffer, len);
+}
+
+static uint64_t GetTimeMS()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+CFSVerifier::CFSVerifier() :
+  m_threads  (0    ),
+  m_hashType (IHashEngine::HT_MD5),
+  m_directIO (false),
+  m_dropCache(true ),
+  m_order    (ORDER_NONE),
+  m_manifest (NULL ),
+  m_governor (NULL ),
+  m_paranoid (0    ),
+  m_checkpoint(0   ),
+  m_shardIndex(0   ),
+  m_shardCount(1   ),
+  m_fanFD    (-1   ),
+  m_inFD     (-1   ),
+  m_monitorHasher(NULL)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+  pthread_mutex_init(&m_dirtyLock, NULL);
+}
 
 CFSVerifier::~CFSVerifier()
 {
-  /* free records */
-  while(!m_files.empty())
+  StopMonitor();
+  pthread_mutex_destroy(&m_dirtyLock);
+}
+
+void CFSVerifier::SetThreads(const unsigned int threads)
+{
+  m_threads = threads;
+}
+
+void CFSVerifier::SetHashType(const IHashEngine::Type type)
+{
+  m_hashType = type;
+}
+
+void CFSVerifier::SetDirectIO(const bool direct)
+{
+  m_directIO = direct;
+}
+
+void CFSVerifier::SetDropCache(const bool drop)
+{
+  m_dropCache = drop;
+}
+
+void CFSVerifier::SetOrder(const Order order)
+{
+  m_order = order;
+}
+
+void CFSVerifier::SetPackageManifest(const CPackageManifest *manifest)
+{
+  m_manifest = manifest;
+}
+
+void CFSVerifier::SetGovernor(CGovernor *governor)
+{
+  m_governor = governor;
+}
+
+void CFSVerifier::SetShard(const unsigned int index, const unsigned int count)
+{
+  /* the shard is stored as a uint16 in the baseline header */
+  m_shardCount = count == 0 ? 1 : (count > UINT16_MAX ? UINT16_MAX : count);
+  m_shardIndex = index % m_shardCount;
+}
+
+unsigned int CFSVerifier::GetShard(const char *path, const size_t len, const unsigned int count)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for(size_t i = 0; i < len; ++i)
+  {
+    hash ^= (unsigned char)path[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return count > 1 ? hash % count : 0;
+}
+
+void CFSVerifier::SetCacheFile(const std::string &path)
+{
+  m_cacheFile = path;
+}
+
+void CFSVerifier::SetParanoid(const unsigned int days)
+{
+  m_paranoid = days;
+}
+
+void CFSVerifier::SetCheckpoint(const unsigned int interval)
+{
+  m_checkpoint = interval;
+}
+
+bool CFSVerifier::GetCheckpoint(unsigned int &index, unsigned int &count)
+{
+  if (m_cacheFile.empty())
+    return false;
+
+  const std::string marker = m_cacheFile + CHECKPOINT_SUFFIX;
+  std::ifstream input(marker.c_str(), std::ios::in | std::ios::binary);
+  if (!input.good())
+    return false;
+
+  char     magic[4];
+  uint64_t version, shardIndex, shardCount;
+  input.read(magic, sizeof(magic));
+  if (input.gcount() < (std::streamsize)sizeof(magic) || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)
+    return false;
+
+  if (!ReadLE(input, version   , 1) || version != CHECKPOINT_VERSION ||
+      !ReadLE(input, shardIndex, 2) ||
+      !ReadLE(input, shardCount, 2) || shardIndex >= shardCount)
+    return false;
+
+  index = shardIndex;
+  count = shardCount;
+  return true;
+}
+
+void CFSVerifier::SetCacheKey(CacheEntry &entry, const struct stat &st)
+{
+  entry.m_dev   = st.st_dev;
+  entry.m_ino   = st.st_ino;
+  entry.m_size  = st.st_size;
+  entry.m_mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+  entry.m_ctime = (uint64_t)st.st_ctim.tv_sec * 1000000000ULL + st.st_ctim.tv_nsec;
+}
+
+bool CFSVerifier::CacheKeyMatch(const CacheEntry &a, const CacheEntry &b)
+{
+  return
+    a.m_dev   == b.m_dev   &&
+    a.m_ino   == b.m_ino   &&
+    a.m_size  == b.m_size  &&
+    a.m_mtime == b.m_mtime &&
+    a.m_ctime == b.m_ctime;
+}
+
+bool CFSVerifier::LoadCache(CacheMap &cache, uint64_t &full)
+{
+  std::ifstream input(m_cacheFile.c_str(), std::ios::in | std::ios::binary);
+  if (!input.good())
+    return false;
+
+  char     magic[4];
+  uint64_t version;
+  input.read(magic, sizeof(magic));
+  if (input.gcount() < (std::streamsize)sizeof(magic) || memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0)
+    return false;
+
+  if (!ReadLE(input, version, 1) || version != CACHE_VERSION)
+    return false;
+
+  /* a cache of digests from another engine is of no use */
+  uint64_t type;
+  if (!ReadLE(input, type, 1) || type != (uint64_t)m_hashType)
+    return false;
+  const size_t digestLen = m_files.GetDigestLength();
+
+  if (!ReadLE(input, full, 8))
+    return false;
+
+  uint64_t length;
+  while(ReadLE(input, length, 2))
+  {
+    char buffer[length];
+    input.read(buffer, length);
+    if (input.gcount() < (std::streamsize)length)
+      return false;
+
+    CacheEntry entry;
+    if (!ReadLE(input, entry.m_dev  , 8) ||
+        !ReadLE(input, entry.m_ino  , 8) ||
+        !ReadLE(input, entry.m_size , 8) ||
+        !ReadLE(input, entry.m_mtime, 8) ||
+        !ReadLE(input, entry.m_ctime, 8))
+      return false;
+
+    input.read((char *)entry.m_digest, digestLen);
+    if (input.gcount() < (std::streamsize)digestLen)
+      return false;
+
+    cache.insert(CachePair(std::string(buffer, length), entry));
+  }
+
+  return true;
+}
+
+bool CFSVerifier::SaveCache(const CacheMap &cache, const uint64_t full)
+{
+  /* write to a temporary file and rename it so a crash can't leave a torn cache */
+  const std::string tmp = m_cacheFile + ".tmp";
+  {
+    std::ofstream output(tmp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!output.good())
+      return false;
+
+    output.write(CACHE_MAGIC, 4);
+    WriteLE(output, CACHE_VERSION, 1);
+    WriteLE(output, m_hashType   , 1);
+    WriteLE(output, full         , 8);
+    const size_t digestLen = m_files.GetDigestLength();
+
+    for(CacheMap::const_iterator it = cache.begin(); it != cache.end(); ++it)
+    {
+      WriteLE(output, it->first.length(), 2);
+      output.write(it->first.c_str(), it->first.length());
+      WriteLE(output, it->second.m_dev  , 8);
+      WriteLE(output, it->second.m_ino  , 8);
+      WriteLE(output, it->second.m_size , 8);
+      WriteLE(output, it->second.m_mtime, 8);
+      WriteLE(output, it->second.m_ctime, 8);
+      output.write((const char *)it->second.m_digest, digestLen);
+    }
+
+    output.flush();
+    if (!output.good())
+    {
+      unlink(tmp.c_str());
+      return false;
+    }
+  }
+
+  chmod(tmp.c_str(), S_IRUSR | S_IWUSR);
+  return rename(tmp.c_str(), m_cacheFile.c_str()) == 0;
+}
+
+void CFSVerifier::Checkpoint(CheckpointState &state, const bool force)
+{
+  /* this is called for every file walked, only look at the clock now and then */
+  if (!force && ++state.m_calls % 256 != 0)
+    return;
+
+  const uint64_t now = GetTimeMS();
+  if (now < state.m_due)
+    return;
+
+  DigestList completed;
+  pthread_mutex_lock  (&state.m_lock);
+  completed.swap(state.m_completed);
+  pthread_mutex_unlock(&state.m_lock);
+
+  /* merge the new digests into the loaded cache and save it */
+  const size_t digestLen = m_files.GetDigestLength();
+  for(DigestList::const_iterator it = completed.begin(); it != completed.end(); ++it)
+  {
+    QueuedMap::iterator queued = state.m_queued.find(*it);
+    if (queued == state.m_queued.end())
+      continue;
+
+    CacheMap::iterator entry = queued->second;
+    memcpy(entry->second.m_digest, *it, digestLen);
+    (*state.m_cache)[entry->first] = entry->second;
+    state.m_queued.erase(queued);
+  }
+
+  uint64_t taken = 0;
+  if (!completed.empty())
   {
-    delete[] m_files.begin()->second;
-    m_files.erase(m_files.begin());
+    SaveCache(*state.m_cache, state.m_full);
+    taken = GetTimeMS() - now;
+    ++m_stats.m_ckpt;
+    m_stats.m_ckptTime += taken;
   }
+
+  /* space the checkpoints out so they cost no more than 5% of the scan */
+  state.m_due = now + std::max((uint64_t)m_checkpoint * 1000, taken * 20);
 }
 
-void CFSVerifier::AddExclude(const std::string &path)
+void CFSVerifier::AddExclude(const std::string &pattern)
 {
-  m_exclude.push_back(path);
+  m_matcher.AddExclude(pattern);
+}
+
+void CFSVerifier::AddInclude(const std::string &pattern)
+{
+  m_matcher.AddInclude(pattern);
 }
 
 bool CFSVerifier::AddPath(std::string path, const bool recurse)
@@ -60,170 +400,1186 @@ bool CFSVerifier::AddPath(std::string path, const bool recurse)
 
   /* resolve the path to a realpath */
   char *resolved = realpath(path.c_str(), NULL);
+  if (!resolved)
+    return false;
   path.assign(resolved);
   free(resolved);
 
-  /* check if the path is in the exclude list */
-  for(StringList::const_iterator it = m_exclude.begin(); it != m_exclude.end(); ++it)
+  /* an explicitly added path is protected even below an excluded one */
+  m_matcher.AddInclude(path);
+
+  return m_roots.insert(PathPair(path, recurse)).second;
+}
+
+void CFSVerifier::Walk(WalkContext &ctx, const int fd, const bool recurse, const CPathMatcher::State &state)
+{
+  /* dont walk a directory twice, links and overlapping paths can lead back to it */
+  if (!m_paths.insert(PathPair(ctx.m_path, recurse)).second)
   {
-    if (strncmp(it->c_str(), path.c_str(), it->length()) == 0)
-      return false;
+    close(fd);
+    return;
   }
 
-  /* dont insert duplicates */
-  if (m_paths.find(path) != m_paths.end())
-    return false;
+  ++ctx.m_dirs;
+  uint32_t dirID = 0;
+  if (ctx.m_monitor)
+    AddWatch(ctx.m_path);
+  else
+    dirID = m_files.AddDir(ctx.m_path);
 
-  /* add the path */
-  m_paths.insert(PathPair(path, recurse));
+  /* read the whole directory before descending so one buffer serves the walk */
+  StringList          dirs, links;
+  CPathMatcher::State child;
+  CDirReader::Entry   entry;
+  struct stat         st;
 
-  /* check for recursion */
-  if (recurse)
+  ctx.m_reader.Open(fd);
+  while(ctx.m_reader.Next(entry))
   {
-    DIR *dh = opendir(path.c_str());
-    while(struct dirent *dir = readdir(dh))
+    m_matcher.Step(state, entry.m_name, child);
+    if (child.m_decision == CPathMatcher::MATCH_EXCLUDE)
+      continue;
+
+    /* only stat when the filesystem does not report the type */
+    unsigned char      type = entry.m_type;
+    const struct stat *pst  = NULL;
+    if (type == DT_UNKNOWN)
     {
-      if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0)
+      ++ctx.m_stat;
+      if (fstatat(fd, entry.m_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
         continue;
 
-      std::string next = path;
-      next.append("/");
-      next.append(dir->d_name);
+      pst = &st;
+      if      (S_ISDIR(st.st_mode)) type = DT_DIR;
+      else if (S_ISLNK(st.st_mode)) type = DT_LNK;
+      else if (S_ISREG(st.st_mode)) type = DT_REG;
+    }
+
+    switch(type)
+    {
+      case DT_DIR:
+        if (recurse)
+          dirs.push_back(std::string(entry.m_name, entry.m_nameLen));
+        break;
+
+      case DT_LNK:
+        if (recurse)
+          links.push_back(std::string(entry.m_name, entry.m_nameLen));
+        break;
 
-      AddPath(next, true);
+      case DT_REG:
+        WalkFile(ctx, dirID, fd, entry, pst);
+        break;
     }
-    closedir(dh);
   }
 
-  return true;
-}
+  const size_t base = ctx.m_path.length();
+  for(StringList::const_iterator it = dirs.begin(); it != dirs.end(); ++it)
+  {
+    int sub = openat(fd, it->c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (sub < 0)
+      continue;
 
-void CFSVerifier::Scan()
-{
-  for(PathMap::iterator it = m_paths.begin(); it != m_paths.end(); ++it)
+    m_matcher.Step(state, it->c_str(), child);
+    ctx.m_path.append(1, '/');
+    ctx.m_path.append(*it);
+    Walk(ctx, sub, true, child);
+    ctx.m_path.resize(base);
+  }
+
+  /* links to directories are followed to their real path, links to files are not */
+  for(StringList::const_iterator it = links.begin(); it != links.end(); ++it)
   {
-    DIR *dh = opendir(it->first.c_str());
-    if (!dh)
+    ++ctx.m_stat;
+    if (fstatat(fd, it->c_str(), &st, 0) < 0 || !S_ISDIR(st.st_mode))
       continue;
 
-    while(struct dirent *dir = readdir(dh))
+    std::string link = ctx.m_path + "/" + *it;
+    char *resolved = realpath(link.c_str(), NULL);
+    if (!resolved)
+      continue;
+
+    std::string parent;
+    parent.swap(ctx.m_path);
+    ctx.m_path.assign(resolved);
+    free(resolved);
+
+    if (m_matcher.Match(ctx.m_path, child) != CPathMatcher::MATCH_EXCLUDE)
     {
-      if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0)
-        continue;
+      int sub = open(ctx.m_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (sub > -1)
+        Walk(ctx, sub, true, child);
+    }
 
-      std::string path = it->first;
-      path.append("/");
-      path.append(dir->d_name);
+    ctx.m_path.swap(parent);
+  }
 
-      struct stat st;
-      if (lstat(path.c_str(), &st) < 0)
-        continue;
+  close(fd);
+}
 
-      if (!S_ISREG(st.st_mode))
-        continue;
+void CFSVerifier::WalkFile(WalkContext &ctx, const uint32_t dirID, const int fd, const CDirReader::Entry &entry, const struct stat *st)
+{
+  const size_t base = ctx.m_path.length();
+  ctx.m_path.append(1, '/');
+  ctx.m_path.append(entry.m_name, entry.m_nameLen);
 
-      unsigned char *digest = new unsigned char[16];
-      if (md5_file(path.c_str(), digest) != 0)
-      {
-        delete[] digest;
-        continue;
-      }
+  /* files in other shards are left for their own scans */
+  if (!ctx.m_monitor && m_shardCount > 1 &&
+      GetShard(ctx.m_path.c_str(), ctx.m_path.length(), m_shardCount) != m_shardIndex)
+  {
+    ctx.m_path.resize(base);
+    return;
+  }
 
-      m_files.insert(FilePair(path, digest));
+  /* a file the cache does not hold gets a zero digest, so its first
+   * change is reported as a modification */
+  if (ctx.m_cacheOnly)
+  {
+    CacheMap::const_iterator cached = ctx.m_cache->find(ctx.m_path);
+    if (cached == ctx.m_cache->end())
+      m_files.Add(dirID, entry.m_name, entry.m_nameLen, NULL);
+    else
+    {
+      m_files.Add(dirID, entry.m_name, entry.m_nameLen, cached->second.m_digest);
+      ++m_stats.m_cached;
+    }
+
+    ctx.m_path.resize(base);
+    return;
+  }
+
+  /* the stat cache needs the inode details, without it d_type is enough */
+  struct stat local;
+  if (ctx.m_useCache && !ctx.m_monitor && !st)
+  {
+    ++ctx.m_stat;
+    if (fstatat(fd, entry.m_name, &local, AT_SYMLINK_NOFOLLOW) < 0 || !S_ISREG(local.st_mode))
+    {
+      ctx.m_path.resize(base);
+      return;
     }
-    closedir(dh);
+    st = &local;
+  }
+
+  bool               hash = !ctx.m_monitor;
+  CacheMap::iterator slot;
+  if (ctx.m_monitor)
+    MarkDirty(ctx.m_path);
+  else if (ctx.m_useCache)
+  {
+    CacheEntry cacheEntry;
+    SetCacheKey(cacheEntry, *st);
+    memset(cacheEntry.m_digest, 0, sizeof(cacheEntry.m_digest));
+
+    /* if the file is unchanged since it was last hashed re-use the digest */
+    CacheMap::const_iterator cached = ctx.m_cache->find(ctx.m_path);
+    if (cached != ctx.m_cache->end() && CacheKeyMatch(cached->second, cacheEntry))
+    {
+      m_files.Add(dirID, entry.m_name, entry.m_nameLen, cached->second.m_digest);
+      memcpy(cacheEntry.m_digest, cached->second.m_digest, m_files.GetDigestLength());
+      ++m_stats.m_cached;
+      hash = false;
+    }
+
+    slot = ctx.m_next->insert(CachePair(ctx.m_path, cacheEntry)).first;
+  }
+
+  if (hash)
+  {
+    ScanItem item;
+    item.m_path   = ctx.m_path;
+    item.m_digest = m_files.Add(dirID, entry.m_name, entry.m_nameLen, NULL);
+    item.m_order  = entry.m_ino;
+
+    if (ctx.m_checkpoint)
+      ctx.m_checkpoint->m_queued.insert(QueuedMap::value_type(item.m_digest, slot));
+
+    if (ctx.m_pending)
+      ctx.m_pending->push_back(item);
+    else if (ctx.m_queue)
+      ctx.m_queue->Push(item);
+    else
+      HashItem(ctx.m_worker, item);
   }
+
+  if (ctx.m_checkpoint)
+    Checkpoint(*ctx.m_checkpoint, false);
+
+  ctx.m_path.resize(base);
 }
 
-bool CFSVerifier::Save(std::ostream &output)
+void CFSVerifier::AddStats(const CFileHasher::Stats &stats)
 {
-  if (!output.good())
-    return false;
+  m_stats.m_files    += stats.m_files;
+  m_stats.m_bytes    += stats.m_bytes;
+  m_stats.m_resident += stats.m_resident;
+  m_stats.m_dropped  += stats.m_dropped;
+  m_stats.m_syscalls += stats.m_syscalls;
+  m_stats.m_latency  += stats.m_latency;
+}
 
-  for(FileMap::const_iterator it = m_files.begin(); it != m_files.end(); ++it)
+void CFSVerifier::HashItem(ScanWorker *worker, const ScanItem &item)
+{
+  /* the digest is written straight into the index's arena */
+  if (!worker->m_hasher->HashFile(item.m_path, item.m_digest))
   {
-    uint16_t length = it->first.length();
-    if (CCommon::IsBE())
-      swab(&length, &length, sizeof(length));
+    worker->m_failed.push_back(item.m_digest);
+    return;
+  }
 
-    output.write((const char *)&length   , sizeof(length));
-    output.write(it->first.c_str()       , length        );
-    output.write((const char *)it->second, 16            );
+  if (worker->m_checkpoint)
+  {
+    worker->m_completed.push_back(item.m_digest);
+    Completed(worker);
   }
+}
 
-  return true;
+void CFSVerifier::Completed(ScanWorker *worker)
+{
+  if (!worker->m_checkpoint || worker->m_completed.empty())
+    return;
+
+  CheckpointState *state = worker->m_checkpoint;
+  pthread_mutex_lock  (&state->m_lock);
+  state->m_completed.insert(state->m_completed.end(), worker->m_completed.begin(), worker->m_completed.end());
+  pthread_mutex_unlock(&state->m_lock);
+  worker->m_completed.clear();
 }
 
-bool CFSVerifier::Diff(std::istream &input, DiffList &result)
+bool CFSVerifier::GetExtent(const std::string &path, uint64_t &physical)
 {
-  if (!input.good())
+  int fd = open(path.c_str(), O_RDONLY | O_NOATIME | O_CLOEXEC);
+  if (fd < 0 && errno == EPERM)
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
     return false;
 
-  FileMap  compare;
-  uint16_t length;
-  while(!input.eof())
+  /* we only need the first extent to know where the file starts */
+  union
   {
-    input.read((char *)&length, sizeof(length));
-    if (CCommon::IsBE())
-      swab(&length, &length, sizeof(length));
-
-    if (input.gcount() < (std::streamsize)sizeof(length))
-      return false;
+    struct fiemap map;
+    char          buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+  } fm;
 
-    char buffer[length];
-    input.read((char *)&buffer, length);
-    if (input.gcount() < (std::streamsize)length)
-      return false;
+  memset(&fm, 0, sizeof(fm));
+  fm.map.fm_start        = 0;
+  fm.map.fm_length       = ~0ULL;
+  fm.map.fm_extent_count = 1;
 
-    std::string path;
-    path.assign(buffer, length);
+  bool ret = ioctl(fd, FS_IOC_FIEMAP, &fm.map) == 0 && fm.map.fm_mapped_extents > 0;
+  if (ret)
+    physical = fm.map.fm_extents[0].fe_physical;
 
-    unsigned char *hash = new unsigned char[16];
-    input.read((char *)hash, 16);
-    if (input.gcount() < (std::streamsize)16)
-      return false;
+  close(fd);
+  return ret;
+}
 
-    compare.insert(FilePair(path, hash));
+void *CFSVerifier::ScanThread(void *arg)
+{
+  ScanWorker *worker = (ScanWorker *)arg;
+  if (worker->m_governor)
+    worker->m_governor->Apply();
 
-    FileMap::const_iterator it = m_files.find(path);
-    if (it == m_files.end())
+  ScanItem item;
+#if defined(HAS_IO_URING)
+  /* keep the ring full, only blocking for work when nothing is in flight */
+  CURingHasher *ring = worker->m_ring;
+  if (ring)
+  {
+    CURingHasher::WorkList abandoned;
+    bool open = true;
+    while(ring->IsReady() && (open || ring->GetPending() > 0))
     {
-      DiffRecord record;
-      record.m_path = path;
-      record.m_type = DT_MISSING;
-      result.push_back(record);
-      continue;
+      while(open && ring->GetPending() < ring->GetDepth())
+      {
+        if (ring->GetPending() == 0)
+          open = worker->m_queue->Pop(item);
+        else if (!worker->m_queue->TryPop(item))
+          break;
+
+        if (open)
+          ring->Submit(item.m_path, item.m_digest);
+      }
+
+      ring->Wait(worker->m_failed, abandoned);
+      Completed(worker);
     }
 
-    if (memcmp(it->second, hash, 16) != 0)
+    /* the files in flight when the ring failed still need hashing */
+    for(CURingHasher::WorkList::iterator it = abandoned.begin(); it != abandoned.end(); ++it)
     {
-      DiffRecord record;
-      record.m_path = path;
-      record.m_type = DT_MODIFIED;
-      result.push_back(record);
-      continue;
+      item.m_path   = it->first;
+      item.m_digest = it->second;
+      item.m_order  = 0;
+      HashItem(worker, item);
     }
   }
+#endif
+
+  /* hash anything left if the ring was unavailable or failed */
+  while(worker->m_queue->Pop(item))
+    HashItem(worker, item);
+
+  return NULL;
+}
 
-  /* look for new files */
-  for(FileMap::const_iterator it = m_files.begin(); it != m_files.end(); ++it)
+void CFSVerifier::WalkRoots(WalkContext &ctx)
+{
+  m_paths.clear();
+  for(PathMap::iterator it = m_roots.begin(); it != m_roots.end(); ++it)
   {
-    if (compare.find(it->first) == compare.end())
-    {
-      DiffRecord record;
-      record.m_path = it->first;
-      record.m_type = DT_NEW;
-      result.push_back(record);
-    }
+    CPathMatcher::State state;
+    if (m_matcher.Match(it->first, state) == CPathMatcher::MATCH_EXCLUDE)
+      continue;
+
+    int fd = open(it->first.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+      continue;
+
+    ctx.m_path = it->first;
+    Walk(ctx, fd, it->second, state);
   }
+}
+
+void CFSVerifier::ScanCached()
+{
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
 
-  /* free loaded records */
-  while(!compare.empty())
+  m_tree.Clear();
   {
-    delete[] compare.begin()->second;
-    compare.erase(compare.begin());
+    IHashEngine *engine = CHashFactory::Create(m_hashType);
+    m_files.SetDigestLength(engine->GetDigestLength());
+    delete engine;
   }
 
-  return true;
-}
+  CacheMap cache;
+  uint64_t full;
+  if (m_cacheFile.empty() || !LoadCache(cache, full))
+    cache.clear();
+
+  memset(&m_stats, 0, sizeof(m_stats));
+  m_mismatches.clear();
 
+  WalkContext ctx;
+  ctx.m_monitor    = false;
+  ctx.m_cacheOnly  = true;
+  ctx.m_useCache   = false;
+  ctx.m_cache      = &cache;
+  ctx.m_next       = NULL;
+  ctx.m_queue      = NULL;
+  ctx.m_pending    = NULL;
+  ctx.m_worker     = NULL;
+  ctx.m_checkpoint = NULL;
+  ctx.m_dirs       = 0;
+  ctx.m_stat       = 0;
+  WalkRoots(ctx);
+
+  m_files.Sort();
+  m_stats.m_files    = m_files.Size();
+  m_stats.m_dirs     = ctx.m_dirs;
+  m_stats.m_getdents = ctx.m_reader.GetCalls();
+  m_stats.m_memory   = m_files.GetMemoryUsage();
+
+  gettimeofday(&end, NULL);
+  m_stats.m_elapsed =
+    (uint64_t)(end.tv_sec  - start.tv_sec ) * 1000 +
+              (end.tv_usec - start.tv_usec) / 1000;
+}
+
+void CFSVerifier::Scan()
+{
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+
+  unsigned int threads = m_threads;
+  if (threads == 0)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? cpus : 1;
+  }
+
+  /* size the index for the engine's digests */
+  m_tree.Clear();
+  {
+    IHashEngine *engine = CHashFactory::Create(m_hashType);
+    m_files.SetDigestLength(engine->GetDigestLength());
+    delete engine;
+  }
+  const size_t digestLen = m_files.GetDigestLength();
+
+  /* load the stat cache, unless it is time for a paranoid full rehash */
+  const bool useCache = !m_cacheFile.empty();
+  CacheMap   cache, next;
+  uint64_t   full   = 0;
+  const uint64_t now = start.tv_sec;
+  if (useCache)
+  {
+    if (!LoadCache(cache, full))
+    {
+      cache.clear();
+      full = 0;
+    }
+
+    if (m_paranoid > 0 && now - full >= (uint64_t)m_paranoid * 86400)
+      cache.clear();
+
+    if (cache.empty())
+      full = now;
+  }
+
+  memset(&m_stats, 0, sizeof(m_stats));
+  m_mismatches.clear();
+
+  /* the cache holds what an interrupted scan of this shard got through */
+  const bool        checkpoint = useCache && m_checkpoint > 0;
+  const std::string marker     = m_cacheFile + CHECKPOINT_SUFFIX;
+  CheckpointState   state;
+  {
+    unsigned int index, count;
+    m_stats.m_resumed = GetCheckpoint(index, count) && index == m_shardIndex && count == m_shardCount;
+  }
+
+  if (checkpoint)
+  {
+    pthread_mutex_init(&state.m_lock, NULL);
+    state.m_cache = &cache;
+    state.m_full  = full;
+    state.m_calls = 0;
+    state.m_due   = GetTimeMS() + (uint64_t)m_checkpoint * 1000;
+
+    std::ofstream output(marker.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    output.write(CHECKPOINT_MAGIC, 4);
+    WriteLE(output, CHECKPOINT_VERSION, 1);
+    WriteLE(output, m_shardIndex      , 2);
+    WriteLE(output, m_shardCount      , 2);
+  }
+
+  /* start the hashing threads */
+  ScanQueue               queue(threads * SCAN_QUEUE_DEPTH);
+  std::vector<ScanWorker> workers(threads);
+  unsigned int            started = 0;
+  for(unsigned int i = 0; i < threads; ++i)
+  {
+    workers[i].m_queue  = &queue;
+    workers[i].m_hasher = new CFileHasher(m_hashType);
+    workers[i].m_hasher->SetDirect   (m_directIO );
+    workers[i].m_hasher->SetDropCache(m_dropCache);
+    workers[i].m_hasher->SetGovernor (m_governor );
+    workers[i].m_checkpoint = checkpoint ? &state : NULL;
+
+#if defined(HAS_IO_URING)
+    /* O_DIRECT needs the pread path */
+    workers[i].m_ring = NULL;
+    if (!m_directIO)
+    {
+      workers[i].m_ring = new CURingHasher(m_hashType);
+      workers[i].m_ring->SetDropCache(m_dropCache);
+      workers[i].m_ring->SetGovernor (m_governor );
+      if (checkpoint)
+        workers[i].m_ring->SetCompleted(&workers[i].m_completed);
+      if (!workers[i].m_ring->IsReady())
+      {
+        delete workers[i].m_ring;
+        workers[i].m_ring = NULL;
+      }
+    }
+#endif
+    workers[i].m_governor = m_governor;
+  }
+
+  for(; started < threads; ++started)
+  {
+    if (pthread_create(&workers[started].m_thread, NULL, ScanThread, &workers[started]) != 0)
+      break;
+  }
+
+  ScanList    pending;
+  WalkContext ctx;
+  ctx.m_monitor    = false;
+  ctx.m_cacheOnly  = false;
+  ctx.m_useCache   = useCache;
+  ctx.m_cache      = &cache;
+  ctx.m_next       = &next;
+  ctx.m_queue      = started > 0 ? &queue : NULL;
+  ctx.m_pending    = m_order != ORDER_NONE ? &pending : NULL;
+  ctx.m_worker     = &workers[0];
+  ctx.m_checkpoint = checkpoint ? &state : NULL;
+  ctx.m_dirs       = 0;
+  ctx.m_stat       = 0;
+
+  WalkRoots(ctx);
+
+  m_stats.m_dirs     = ctx.m_dirs;
+  m_stats.m_stat     = ctx.m_stat;
+  m_stats.m_getdents = ctx.m_reader.GetCalls();
+
+  /* hash the files in the order they are laid out on disk */
+  if (ctx.m_pending)
+  {
+    struct timeval orderStart, orderEnd;
+    gettimeofday(&orderStart, NULL);
+
+    /* files with an extent sort after those without so the two kinds of key never mix */
+    if (m_order == ORDER_EXTENT)
+      for(ScanList::iterator it = pending.begin(); it != pending.end(); ++it)
+      {
+        uint64_t physical;
+        if (GetExtent(it->m_path, physical))
+        {
+          it->m_order = (physical >> 1) | (1ULL << 63);
+          ++m_stats.m_extents;
+        }
+        else
+          it->m_order >>= 1;
+      }
+
+    std::sort(pending.begin(), pending.end(), ScanItemLess());
+    gettimeofday(&orderEnd, NULL);
+    m_stats.m_ordering =
+      (uint64_t)(orderEnd.tv_sec  - orderStart.tv_sec ) * 1000 +
+                (orderEnd.tv_usec - orderStart.tv_usec) / 1000;
+
+    for(ScanList::const_iterator it = pending.begin(); it != pending.end(); ++it)
+    {
+      if (started == 0)
+        HashItem(&workers[0], *it);
+      else
+        queue.Push(*it);
+
+      if (checkpoint)
+        Checkpoint(state, false);
+    }
+    ScanList().swap(pending);
+  }
+
+  /* wait for the queue to drain */
+  queue.Close();
+  for(unsigned int i = 0; i < started; ++i)
+  {
+    if (!checkpoint)
+    {
+      pthread_join(workers[i].m_thread, NULL);
+      continue;
+    }
+
+    /* keep checkpointing while the last files are hashed */
+    struct timespec deadline;
+    do
+    {
+      Checkpoint(state, true);
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      ++deadline.tv_sec;
+    }
+    while(pthread_timedjoin_np(workers[i].m_thread, NULL, &deadline) == ETIMEDOUT);
+  }
+
+  /* drop the files that failed to hash and sort the index by path */
+  m_stats.m_files   = m_stats.m_cached;
+  m_stats.m_threads = started > 0 ? started : 1;
+  for(unsigned int i = 0; i < workers.size(); ++i)
+  {
+    m_files.Remove(workers[i].m_failed);
+
+    AddStats(workers[i].m_hasher->GetStats());
+    delete workers[i].m_hasher;
+
+#if defined(HAS_IO_URING)
+    if (workers[i].m_ring)
+    {
+      AddStats(workers[i].m_ring->GetStats());
+      delete workers[i].m_ring;
+      m_stats.m_uring = true;
+    }
+#endif
+  }
+  m_stats.m_displaced = m_stats.m_bytes - m_stats.m_resident - m_stats.m_dropped;
+
+  m_files.Sort();
+  m_stats.m_memory = m_files.GetMemoryUsage();
+
+  /* store the new digests in the cache, dropping files that failed to hash */
+  if (useCache)
+  {
+    for(CacheMap::iterator it = next.begin(); it != next.end();)
+    {
+      size_t index;
+      if (!m_files.Find(it->first, index))
+      {
+        next.erase(it++);
+        continue;
+      }
+
+      memcpy(it->second.m_digest, m_files.GetDigest(index), digestLen);
+      ++it;
+    }
+
+    /* keep what the other shards cached for their own runs */
+    if (m_shardCount > 1)
+      for(CacheMap::const_iterator it = cache.begin(); it != cache.end(); ++it)
+        if (GetShard(it->first.c_str(), it->first.length(), m_shardCount) != m_shardIndex)
+          next.insert(*it);
+
+    SaveCache(next, full);
+  }
+
+  /* the scan completed, there is nothing to resume */
+  if (checkpoint)
+  {
+    unlink(marker.c_str());
+    pthread_mutex_destroy(&state.m_lock);
+  }
+
+  /* files that match their package need not be in the baseline */
+  if (m_manifest && m_manifest->GetType() == m_hashType)
+  {
+    DigestList  owned;
+    std::string path;
+    for(size_t i = 0; i < m_files.Size(); ++i)
+    {
+      m_files.GetPath(i, path);
+      const unsigned char *expected = m_manifest->Find(path.c_str(), path.length());
+      if (!expected)
+        continue;
+
+      owned.push_back(m_files.GetDigest(i));
+      if (memcmp(expected, m_files.GetDigest(i), digestLen) == 0)
+      {
+        ++m_stats.m_packaged;
+        continue;
+      }
+
+      DiffRecord record;
+      record.m_path = path;
+      record.m_type = DT_MODIFIED;
+      m_mismatches.push_back(record);
+    }
+    m_files.Remove(owned);
+  }
+
+  gettimeofday(&end, NULL);
+  m_stats.m_elapsed =
+    (uint64_t)(end.tv_sec  - start.tv_sec ) * 1000 +
+              (end.tv_usec - start.tv_usec) / 1000;
+}
+
+void CFSVerifier::WriteHeader(std::ostream &output, const char *magic, const unsigned int version)
+{
+  /* write the header so readers know the version and engine */
+  unsigned char header[BASELINE_HEADER_SIZE + BASELINE_SHARD_SIZE];
+  memcpy(header, magic, 4);
+  header[4]  = version;
+  header[5]  = m_hashType;
+  header[6]  = m_files.GetDigestLength();
+  header[7]  = m_shardIndex & 0xFF;
+  header[8]  = m_shardIndex >> 8;
+  header[9]  = m_shardCount & 0xFF;
+  header[10] = m_shardCount >> 8;
+  output.write((const char *)header, sizeof(header));
+}
+
+bool CFSVerifier::Save(std::ostream &output, const unsigned int version/* = BASELINE_VERSION */)
+{
+  if (!output.good() || version < 2 || version > BASELINE_VERSION)
+    return false;
+
+  WriteHeader(output, BASELINE_MAGIC, version);
+
+  const size_t digestLen = m_files.GetDigestLength();
+  std::string  path;
+  if (version >= 3)
+  {
+    /* the index is sorted, so each path shares what it can with the last */
+    std::string last;
+    for(size_t i = 0; i < m_files.Size(); ++i)
+    {
+      m_files.GetPath(i, path);
+
+      const size_t max    = std::min(path.length(), last.length());
+      size_t       shared = 0;
+      while(shared < max && path[shared] == last[shared])
+        ++shared;
+
+      WriteVarint(output, shared);
+      WriteVarint(output, path.length() - shared);
+      output.write(path.c_str() + shared              , path.length() - shared);
+      output.write((const char *)m_files.GetDigest(i) , digestLen             );
+      last.swap(path);
+    }
+
+    return true;
+  }
+
+  for(size_t i = 0; i < m_files.Size(); ++i)
+  {
+    m_files.GetPath(i, path);
+
+    uint16_t length = path.length();
+    if (CCommon::IsBE())
+      swab(&length, &length, sizeof(length));
+
+    output.write((const char *)&length              , sizeof(length));
+    output.write(path.c_str()                       , path.length() );
+    output.write((const char *)m_files.GetDigest(i) , digestLen     );
+  }
+
+  return true;
+}
+
+bool CFSVerifier::BuildTree()
+{
+  if (m_tree.IsBuilt())
+    return true;
+  return m_tree.Build(m_files, m_hashType);
+}
+
+bool CFSVerifier::SaveSummary(std::ostream &output)
+{
+  if (!output.good() || !BuildTree())
+    return false;
+
+  WriteHeader(output, TREE_MAGIC, TREE_VERSION);
+
+  /* links can lead outside of the protected paths, the root covers those too */
+  StringList paths;
+  paths.push_back("/");
+  for(PathMap::const_iterator it = m_roots.begin(); it != m_roots.end(); ++it)
+    if (it->first != "/")
+      paths.push_back(it->first);
+
+  const size_t digestLen = m_files.GetDigestLength();
+  for(StringList::const_iterator it = paths.begin(); it != paths.end(); ++it)
+  {
+    /* roots with no files below them have nothing to summarise */
+    const CMerkleTree::Node *node = m_tree.Find(*it);
+    if (!node)
+      continue;
+
+    WriteLE(output, it->length(), 2);
+    output.write(it->c_str(), it->length());
+    WriteLE(output, node->m_count, 4);
+    output.write((const char *)node->m_digest, digestLen);
+  }
+
+  return true;
+}
+
+bool CFSVerifier::SaveTree(std::ostream &output, const StringList &paths)
+{
+  if (!output.good() || !BuildTree())
+    return false;
+
+  WriteHeader(output, TREE_MAGIC, TREE_VERSION);
+
+  const size_t           digestLen = m_files.GetDigestLength();
+  CMerkleTree::ChildList children;
+  for(StringList::const_iterator it = paths.begin(); it != paths.end(); ++it)
+  {
+    /* a directory we dont have is sent with no children */
+    const CMerkleTree::Node *node = m_tree.Find(*it);
+    if (node)
+      m_tree.GetChildren(*node, children);
+    else
+      children.clear();
+
+    WriteLE(output, it->length(), 2);
+    output.write(it->c_str(), it->length());
+    WriteLE(output, children.size(), 4);
+
+    for(CMerkleTree::ChildList::const_iterator child = children.begin(); child != children.end(); ++child)
+    {
+      WriteLE(output, child->m_type, 1);
+      WriteLE(output, child->m_name.length(), 2);
+      output.write(child->m_name.c_str(), child->m_name.length());
+      output.write((const char *)child->m_digest, digestLen);
+    }
+  }
+
+  return true;
+}
+
+bool CFSVerifier::Diff(std::istream &input, DiffList &result)
+{
+  CBaselineReader reader;
+  if (!reader.Open(input))
+    return false;
+
+  return Diff(reader, result);
+}
+
+bool CFSVerifier::Diff(const std::string &file, DiffList &result)
+{
+  CBaselineReader reader;
+  if (!reader.Open(file))
+    return false;
+
+  return Diff(reader, result);
+}
+
+bool CFSVerifier::Diff(CBaselineReader &reader, DiffList &result)
+{
+  /* digests from different engines can't be compared */
+  if (reader.GetType() != m_hashType || reader.GetDigestLength() != m_files.GetDigestLength())
+    return false;
+
+  /* nor can baselines of a different set of files */
+  if (reader.GetShardIndex() != m_shardIndex || reader.GetShardCount() != m_shardCount)
+    return false;
+
+  /* both the baseline and the index are sorted so a single merge pass will do */
+  size_t                  index = 0;
+  std::string             last;
+  CBaselineReader::Record record;
+  while(reader.Next(record))
+  {
+    /* a baseline out of order can't be merged */
+    if (index > 0 && last.compare(0, last.length(), record.m_path, record.m_pathLen) >= 0)
+      return false;
+    last.assign(record.m_path, record.m_pathLen);
+
+    int ret = 1;
+    for(; index < m_files.Size(); ++index)
+    {
+      ret = m_files.Compare(index, record.m_path, record.m_pathLen);
+      if (ret >= 0)
+        break;
+
+      DiffRecord diff;
+      m_files.GetPath(index, diff.m_path);
+      diff.m_type = DT_NEW;
+      result.push_back(diff);
+    }
+
+    if (ret != 0)
+    {
+      DiffRecord diff;
+      diff.m_path.assign(record.m_path, record.m_pathLen);
+      diff.m_type = DT_MISSING;
+      result.push_back(diff);
+      continue;
+    }
+
+    if (memcmp(m_files.GetDigest(index), record.m_digest, m_files.GetDigestLength()) != 0)
+    {
+      DiffRecord diff;
+      diff.m_path.assign(record.m_path, record.m_pathLen);
+      diff.m_type = DT_MODIFIED;
+      result.push_back(diff);
+    }
+
+    ++index;
+  }
+
+  if (reader.IsError())
+    return false;
+
+  /* anything left in the index is new */
+  for(; index < m_files.Size(); ++index)
+  {
+    DiffRecord diff;
+    m_files.GetPath(index, diff.m_path);
+    diff.m_type = DT_NEW;
+    result.push_back(diff);
+  }
+
+  return true;
+}
+
+bool CFSVerifier::StartMonitor()
+{
+  StopMonitor();
+
+  m_inFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_inFD < 0)
+    return false;
+
+  /* fanotify needs CAP_SYS_ADMIN, without it inotify also handles writes */
+  m_fanFD = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK, O_RDONLY | O_LARGEFILE);
+
+  for(PathMap::const_iterator it = m_paths.begin(); it != m_paths.end(); ++it)
+    AddWatch(it->first);
+
+  m_monitorHasher = new CFileHasher(m_hashType);
+  m_monitorHasher->SetDropCache(m_dropCache);
+  m_monitorHasher->SetGovernor (m_governor );
+  return true;
+}
+
+void CFSVerifier::StopMonitor()
+{
+  if (m_fanFD > -1)
+    close(m_fanFD);
+
+  if (m_inFD > -1)
+    close(m_inFD);
+
+  delete m_monitorHasher;
+
+  m_fanFD         = -1;
+  m_inFD          = -1;
+  m_monitorHasher = NULL;
+  m_watches.clear();
+
+  pthread_mutex_lock  (&m_dirtyLock);
+  m_dirty.clear();
+  pthread_mutex_unlock(&m_dirtyLock);
+}
+
+void CFSVerifier::GetMonitorFDs(std::vector<int> &fds)
+{
+  if (m_fanFD > -1) fds.push_back(m_fanFD);
+  if (m_inFD  > -1) fds.push_back(m_inFD );
+}
+
+void CFSVerifier::AddWatch(const std::string &path)
+{
+  uint32_t mask = MONITOR_INOTIFY_MASK;
+  if (m_fanFD < 0 || fanotify_mark(m_fanFD, FAN_MARK_ADD, FAN_CLOSE_WRITE | FAN_EVENT_ON_CHILD, AT_FDCWD, path.c_str()) != 0)
+    mask |= IN_CLOSE_WRITE;
+
+  int wd = inotify_add_watch(m_inFD, path.c_str(), mask);
+  if (wd > -1)
+    m_watches[wd] = path;
+}
+
+void CFSVerifier::MarkDirty(const std::string &path)
+{
+  if (m_matcher.Match(path) == CPathMatcher::MATCH_EXCLUDE)
+    return;
+
+  pthread_mutex_lock  (&m_dirtyLock);
+  m_dirty[path] = time(NULL);
+  pthread_mutex_unlock(&m_dirtyLock);
+}
+
+void CFSVerifier::ForgetDir(const std::string &path)
+{
+  const std::string prefix = path + "/";
+
+  m_paths.erase(path);
+  for(PathMap::iterator it = m_paths.lower_bound(prefix); it != m_paths.end() && it->first.compare(0, prefix.length(), prefix) == 0;)
+    m_paths.erase(it++);
+
+  /* a moved directory's watches would keep reporting under the old paths */
+  for(WatchMap::iterator it = m_watches.begin(); it != m_watches.end();)
+  {
+    if (it->second != path && it->second.compare(0, prefix.length(), prefix) != 0)
+    {
+      ++it;
+      continue;
+    }
+
+    inotify_rm_watch(m_inFD, it->first);
+    m_watches.erase(it++);
+  }
+
+  pthread_mutex_lock  (&m_dirtyLock);
+  m_dirty[prefix] = time(NULL);
+  pthread_mutex_unlock(&m_dirtyLock);
+}
+
+void CFSVerifier::ProcessEvents()
+{
+  char buffer[65536] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  if (m_fanFD > -1)
+  {
+    while((len = read(m_fanFD, buffer, sizeof(buffer))) > 0)
+    {
+      struct fanotify_event_metadata *meta = (struct fanotify_event_metadata *)buffer;
+      for(; FAN_EVENT_OK(meta, len); meta = FAN_EVENT_NEXT(meta, len))
+      {
+        if (meta->fd < 0)
+          continue;
+
+        /* the event carries an open descriptor, resolve it back to a path */
+        char link[64], path[PATH_MAX];
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", meta->fd);
+        ssize_t plen = readlink(link, path, sizeof(path) - 1);
+        close(meta->fd);
+
+        if (plen <= 0)
+          continue;
+
+        /* a directory moved out of the tree keeps its mark, ForgetDir
+         * dropped it from m_paths so its files are ignored */
+        std::string file(path, plen);
+        const size_t slash = file.rfind('/');
+        if (slash != std::string::npos && m_paths.find(file.substr(0, slash)) != m_paths.end())
+          MarkDirty(file);
+      }
+    }
+  }
+
+  while((len = read(m_inFD, buffer, sizeof(buffer))) > 0)
+  {
+    for(char *ptr = buffer; ptr < buffer + len;)
+    {
+      struct inotify_event *event = (struct inotify_event *)ptr;
+      ptr += sizeof(struct inotify_event) + event->len;
+
+      WatchMap::iterator watch = m_watches.find(event->wd);
+      if (watch == m_watches.end())
+        continue;
+
+      /* the watched directory itself was removed or moved */
+      if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+      {
+        const std::string dir = watch->second;
+        ForgetDir(dir);
+        continue;
+      }
+
+      if (event->len == 0)
+        continue;
+
+      std::string path = watch->second;
+      path.append("/");
+      path.append(event->name);
+
+      if ((event->mask & IN_ISDIR) && (event->mask & (IN_DELETE | IN_MOVED_FROM)))
+      {
+        ForgetDir(path);
+        continue;
+      }
+
+      /* watch new directories that appear under a recursive path */
+      if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+      {
+        PathMap::const_iterator parent = m_paths.find(watch->second);
+        if (parent == m_paths.end() || !parent->second)
+          continue;
+
+        CPathMatcher::State state;
+        if (m_matcher.Match(path, state) == CPathMatcher::MATCH_EXCLUDE)
+          continue;
+
+        /* files may have been written before the watch was in place, so
+         * the walk marks everything it finds dirty */
+        int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd > -1)
+        {
+          WalkContext ctx;
+          ctx.m_path       = path;
+          ctx.m_monitor    = true;
+          ctx.m_cacheOnly  = false;
+          ctx.m_useCache   = false;
+          ctx.m_cache      = NULL;
+          ctx.m_next       = NULL;
+          ctx.m_queue      = NULL;
+          ctx.m_pending    = NULL;
+          ctx.m_worker     = NULL;
+          ctx.m_checkpoint = NULL;
+          ctx.m_dirs       = 0;
+          ctx.m_stat       = 0;
+          Walk(ctx, fd, true, state);
+        }
+        continue;
+      }
+
+      if (!(event->mask & IN_ISDIR))
+        MarkDirty(path);
+    }
+  }
+}
+
+bool CFSVerifier::GetChanges(DiffList &result, const unsigned int debounce)
+{
+  if (!m_monitorHasher)
+    return false;
+
+  const time_t  now       = time(NULL);
+  const size_t  digestLen = m_files.GetDigestLength();
+  unsigned char digest[HASH_MAX_DIGEST];
+
+  /* take the settled paths out under the lock so events keep flowing
+   * while they are hashed */
+  std::set<std::string>    settled;
+  std::vector<std::string> dirs;
+  pthread_mutex_lock(&m_dirtyLock);
+  for(DirtyMap::iterator it = m_dirty.begin(); it != m_dirty.end();)
+  {
+    /* wait for the file to settle before rehashing it */
+    if (now - it->second < (time_t)debounce)
+    {
+      ++it;
+      continue;
+    }
+
+    if (*it->first.rbegin() == '/')
+      dirs.push_back(it->first);
+    else
+      settled.insert(it->first);
+    m_dirty.erase(it++);
+  }
+  pthread_mutex_unlock(&m_dirtyLock);
+
+  /* check every indexed file that was in a directory that went away */
+  std::string path;
+  for(std::vector<std::string>::const_iterator dir = dirs.begin(); dir != dirs.end(); ++dir)
+    for(size_t index = m_files.LowerBound(*dir); index < m_files.Size(); ++index)
+    {
+      m_files.GetPath(index, path);
+      if (path.compare(0, dir->length(), *dir) != 0)
+        break;
+      settled.insert(path);
+    }
+
+  DigestList                         removed;
+  std::map<std::string, std::string> added;
+  for(std::set<std::string>::const_iterator it = settled.begin(); it != settled.end(); ++it)
+  {
+    const std::string &path = *it;
+
+    size_t index;
+    const bool known = m_files.Find(path, index);
+
+    struct stat st;
+    if (lstat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode) || !m_monitorHasher->HashFile(path, digest))
+    {
+      if (!known)
+        continue;
+
+      DiffRecord record;
+      record.m_path = path;
+      record.m_type = DT_MISSING;
+      result.push_back(record);
+      removed.push_back(m_files.GetDigest(index));
+      continue;
+    }
+
+    if (!known)
+    {
+      DiffRecord record;
+      record.m_path = path;
+      record.m_type = DT_NEW;
+      result.push_back(record);
+      added[path].assign((const char *)digest, digestLen);
+      continue;
+    }
+
+    if (memcmp(m_files.GetDigest(index), digest, digestLen) != 0)
+    {
+      DiffRecord record;
+      record.m_path = path;
+      record.m_type = DT_MODIFIED;
+      result.push_back(record);
+      memcpy(m_files.GetDigest(index), digest, digestLen);
+    }
+  }
+
+  /* new entries are appended so the index needs sorting again */
+  if (!removed.empty() || !added.empty())
+  {
+    m_files.Remove(removed);
+    for(std::map<std::string, std::string>::const_iterator it = added.begin(); it != added.end(); ++it)
+      m_files.Add(it->first, (const unsigned char *)it->second.data());
+    m_files.Sort();
+  }
+
+  if (!result.empty())
+    m_tree.Clear();
+
+  return !result.empty();
+}
@@ -21,12 +21,25 @@
 #ifndef _CFSVERIFIER_H_
 #define _CFSVERIFIER_H_
 
+#include <stdint.h>
+#include <time.h>
 #include <string>
 #include <ostream>
 #include <map>
 #include <vector>
 
 #include <sys/stat.h>
+#include <pthread.h>
+
+#include "common/CWorkQueue.h"
+#include "CFileHasher.h"
+#include "CFileIndex.h"
+#include "CBaselineReader.h"
+#include "CPathMatcher.h"
+#include "CDirReader.h"
+#include "CMerkleTree.h"
+#include "CURingHasher.h"
+#include "CPackageManifest.h"
 
 class CFSVerifier
 {
@@ -44,28 +57,367 @@ class CFSVerifier
       enum DiffType m_type;
     };
 
-    typedef std::vector<DiffRecord> DiffList;
+    typedef std::vector<DiffRecord > DiffList;
+    typedef std::vector<std::string> StringList;
+
+    enum Order
+    {
+      ORDER_NONE   = 0, /* hash files in the order they are found    */
+      ORDER_INODE  = 1, /* hash files in inode number order          */
+      ORDER_EXTENT = 2  /* hash files in order of their first extent */
+    };
 
+    struct ScanStats
+    {
+      unsigned int m_threads;
+      uint64_t     m_dirs;
+      uint64_t     m_files;
+      uint64_t     m_cached;    /* files whose digest came from the stat cache   */
+      uint64_t     m_bytes;
+      uint64_t     m_resident;  /* bytes hashed that were already in the page cache */
+      uint64_t     m_dropped;   /* bytes hashed and then dropped from the page cache */
+      uint64_t     m_displaced; /* bytes hashed and left behind in the page cache    */
+      uint64_t     m_memory;    /* bytes of heap used by the file index              */
+      uint64_t     m_stat;      /* entries that needed a stat call                   */
+      uint64_t     m_getdents;  /* getdents64 calls made walking the tree            */
+      uint64_t     m_extents;   /* files ordered by their first extent               */
+      uint64_t     m_ordering;  /* milliseconds spent ordering the files             */
+      uint64_t     m_syscalls;  /* system calls made hashing files                   */
+      uint64_t     m_latency;   /* microseconds from opening each file to its digest */
+      uint64_t     m_packaged;  /* files that matched their package's digest         */
+      uint64_t     m_ckpt;      /* checkpoints of the stat cache saved by the scan  */
+      uint64_t     m_ckptTime;  /* milliseconds spent saving checkpoints             */
+      bool         m_resumed;   /* the scan carried on from an interrupted one       */
+      bool         m_uring;     /* files were hashed through io_uring                */
+      uint64_t     m_elapsed;   /* milliseconds */
+    };
 
+    CFSVerifier();
     ~CFSVerifier();
 
-    void AddExclude(const std::string &path);
+    /**
+      * Set the number of hashing threads Scan will use
+      * @param threads The thread count, 0 to use one per online CPU
+      */
+    void SetThreads(const unsigned int threads);
+
+    /**
+      * Select the hash engine used by Scan and recorded by Save, MD5 is the
+      * default for compatibility with older baselines
+      */
+    void SetHashType(const IHashEngine::Type type);
+    IHashEngine::Type GetHashType() { return m_hashType; }
+
+    /**
+      * Read files with O_DIRECT to bypass the page cache where supported
+      */
+    void SetDirectIO(const bool direct);
+
+    /**
+      * Drop files from the page cache after hashing them if they were not
+      * already cached, this is the default
+      */
+    void SetDropCache(const bool drop);
+
+    /**
+      * Sort the files to hash by their location on disk before hashing
+      * them, this saves seeking on rotational disks. Files FIEMAP can't
+      * map fall back to their inode number.
+      */
+    void SetOrder(const Order order);
+
+    /**
+      * Verify package owned files against the package manager's digests,
+      * files that match are left out of the index and so the baseline
+      * @param manifest The manifest, NULL to put every file in the index
+      */
+    void SetPackageManifest(const CPackageManifest *manifest);
+
+    /**
+      * Returns the package owned files that did not match their package
+      * in the last Scan
+      */
+    const DiffList &GetPackageMismatches() { return m_mismatches; }
+
+    /**
+      * Limit the resources Scan and the monitor use, the hashing threads
+      * apply the governor's priority as they start
+      * @param governor The governor, NULL for no limits
+      */
+    void SetGovernor(CGovernor *governor);
+
+    /**
+      * Keep a persistent stat cache so unchanged files are not rehashed
+      * @param path The cache file, empty to disable the cache
+      */
+    void SetCacheFile(const std::string &path);
+
+    /**
+      * Force a full rehash if the last one was this many days ago
+      * @param days The number of days, 0 to always trust the cache
+      */
+    void SetParanoid(const unsigned int days);
+
+    /**
+      * Save the stat cache every so often while Scan hashes so the work is
+      * not lost if the scan is interrupted, the next Scan finds the files
+      * already hashed in the cache. A marker is kept beside the cache until
+      * the scan completes. Checkpoints are spaced out so saving them takes
+      * no more than 5% of the scan.
+      * @param interval The minimum seconds between checkpoints, 0 to disable
+      */
+    void SetCheckpoint(const unsigned int interval);
+
+    /**
+      * Find out if the last checkpointed Scan with this cache file did not
+      * complete, and which shard it was scanning
+      * @return True if there is a scan to resume
+      */
+    bool GetCheckpoint(unsigned int &index, unsigned int &count);
+
+    /**
+      * Only scan the files in one shard of the protected paths, so a full
+      * check can be spread over several runs
+      * @param index The shard to scan
+      * @param count The number of shards, 1 to scan everything
+      */
+    void SetShard(const unsigned int index, const unsigned int count);
+
+    /**
+      * Returns the shard a path belongs to, by an FNV-1a hash of the path
+      */
+    static unsigned int GetShard(const char *path, const size_t len, const unsigned int count);
+
+    /**
+      * Returns the statistics of the last Scan
+      */
+    const ScanStats &GetStats() { return m_stats; }
+
+    /**
+      * Exclude or include paths, see CPathMatcher for the pattern rules
+      */
+    void AddExclude(const std::string &pattern);
+    void AddInclude(const std::string &pattern);
+
+    /**
+      * Add a directory to protect, it is included even if it is below an
+      * excluded path. The tree is not walked until Scan.
+      */
     bool AddPath(std::string path, const bool recurse);
     void Scan();
-    bool Save(std::ostream &output);
+
+    /**
+      * Walk the tree for the monitor without hashing anything. Files take
+      * their digests from the stat cache, those it does not hold are
+      * indexed without one until they change. The cache is not written.
+      */
+    void ScanCached();
+
+    /**
+      * Write the baseline of the last Scan
+      * @param output  The stream to write to
+      * @param version The baseline format, 2 for full paths or 3 for
+      *                front coded paths
+      */
+    bool Save(std::ostream &output, const unsigned int version = BASELINE_VERSION);
+
+    /**
+      * Write the digest of each protected path's tree, this is enough for
+      * the other side to tell if anything differs from its baseline
+      */
+    bool SaveSummary(std::ostream &output);
+
+    /**
+      * Write the immediate children of directories so the other side can
+      * descend into only the subtrees that differ
+      * @param paths The directories to list
+      */
+    bool SaveTree(std::ostream &output, const StringList &paths);
+
+    /**
+      * Compare the scanned files against a saved baseline in a single pass
+      * @param input  The baseline as written by Save
+      * @param result Receives the differences in path order
+      * @return       False if the baseline is malformed, not sorted or was
+      *               made with a different hash engine
+      */
     bool Diff(std::istream &input, DiffList &result);
 
+    /**
+      * Compare against a baseline file, the file is memory mapped rather
+      * than read in to avoid holding a second copy of it
+      */
+    bool Diff(const std::string &file, DiffList &result);
+    bool Diff(CBaselineReader &reader, DiffList &result);
+
+    /**
+      * Start watching the directories found by the last Scan for changes, this uses
+      * fanotify for writes when permitted and inotify for everything else
+      * @return false if the paths could not be watched
+      */
+    bool StartMonitor();
+    void StopMonitor();
+
+    /**
+      * Returns the descriptors that become readable when events are pending
+      */
+    void GetMonitorFDs(std::vector<int> &fds);
+
+    /**
+      * Read any pending events into the dirty set, this does not block and
+      * may run concurrently with GetChanges
+      */
+    void ProcessEvents();
+
+    /**
+      * Rehash the dirty files that have had no events for a while and
+      * update the index to match
+      * @param result   Receives the changes since the file was last hashed
+      * @param debounce Seconds a file must be quiet before it is rehashed
+      * @return         True if anything changed
+      */
+    bool GetChanges(DiffList &result, const unsigned int debounce);
+
   private:
-    typedef std::vector<std::string                > StringList;
+    typedef std::vector<unsigned char *  > DigestList;
+
+    typedef std::map   <std::string, bool> PathMap;
+    typedef std::pair  <std::string, bool> PathPair;
+
+    typedef std::map   <int, std::string   > WatchMap;
+    typedef std::map   <std::string, time_t> DirtyMap;
+
+    struct CacheEntry
+    {
+      uint64_t      m_dev;
+      uint64_t      m_ino;
+      uint64_t      m_size;
+      uint64_t      m_mtime; /* nanoseconds */
+      uint64_t      m_ctime; /* nanoseconds */
+      unsigned char m_digest[HASH_MAX_DIGEST];
+    };
+
+    typedef std::map <std::string, CacheEntry> CacheMap;
+    typedef std::pair<std::string, CacheEntry> CachePair;
+
+    struct ScanItem
+    {
+      std::string    m_path;
+      unsigned char *m_digest;
+      uint64_t       m_order;
+    };
+
+    typedef std::vector<ScanItem> ScanList;
+
+    struct ScanItemLess
+    {
+      bool operator()(const ScanItem &a, const ScanItem &b) const { return a.m_order < b.m_order; }
+    };
+
+    typedef CWorkQueue<ScanItem> ScanQueue;
+
+    typedef std::map<unsigned char *, CacheMap::iterator> QueuedMap;
+
+    struct CheckpointState
+    {
+      pthread_mutex_t m_lock;
+      DigestList      m_completed; /* digests hashed since the last checkpoint, under m_lock */
+      QueuedMap       m_queued;    /* the new cache entry of each queued digest */
+      CacheMap       *m_cache;     /* the loaded cache, completed entries are merged into it */
+      uint64_t        m_full;
+      uint64_t        m_calls;
+      uint64_t        m_due;       /* milliseconds */
+    };
+
+    struct ScanWorker
+    {
+      ScanQueue       *m_queue;
+      pthread_t        m_thread;
+      CFileHasher     *m_hasher;
+      CGovernor       *m_governor;
+      DigestList       m_failed;
+      DigestList       m_completed;
+      CheckpointState *m_checkpoint;
+#if defined(HAS_IO_URING)
+      CURingHasher    *m_ring;
+#endif
+    };
+
+    struct WalkContext
+    {
+      CDirReader       m_reader;
+      std::string      m_path;       /* the directory being walked, entries are appended in place */
+      bool             m_monitor;    /* mark files dirty rather than hashing them */
+      bool             m_cacheOnly;  /* index files with their cached digests rather than hashing them */
+      bool             m_useCache;
+      CacheMap        *m_cache;
+      CacheMap        *m_next;
+      ScanQueue       *m_queue;      /* NULL to hash on the walking thread */
+      ScanList        *m_pending;    /* collects the files when they are to be ordered */
+      ScanWorker      *m_worker;
+      CheckpointState *m_checkpoint; /* NULL when not checkpointing */
+      uint64_t         m_dirs;
+      uint64_t         m_stat;
+    };
+
+    void         AddStats  (const CFileHasher::Stats &stats);
+    static void  HashItem  (ScanWorker *worker, const ScanItem &item);
+    static void  Completed (ScanWorker *worker);
+    static bool  GetExtent (const std::string &path, uint64_t &physical);
+    static void *ScanThread(void *arg);
+
+    static void SetCacheKey  (CacheEntry &entry, const struct stat &st);
+    static bool CacheKeyMatch(const CacheEntry &a, const CacheEntry &b);
+    bool        LoadCache    (CacheMap &cache, uint64_t &full);
+    bool        SaveCache    (const CacheMap &cache, const uint64_t full);
+    void        Checkpoint   (CheckpointState &state, const bool force);
+    bool        BuildTree    ();
+    void        WriteHeader  (std::ostream &output, const char *magic, const unsigned int version);
+
+    unsigned int            m_threads;
+    IHashEngine::Type       m_hashType;
+    bool                    m_directIO;
+    bool                    m_dropCache;
+    Order                   m_order;
+    const CPackageManifest  *m_manifest;
+    DiffList                m_mismatches;
+    CGovernor               *m_governor;
+    ScanStats               m_stats;
+    std::string             m_cacheFile;
+    unsigned int            m_paranoid;
+    unsigned int            m_checkpoint;
+    unsigned int            m_shardIndex;
+    unsigned int            m_shardCount;
+
+    void WalkRoots(WalkContext &ctx);
+    void Walk     (WalkContext &ctx, const int fd, const bool recurse, const CPathMatcher::State &state);
+    void WalkFile (WalkContext &ctx, const uint32_t dirID, const int fd, const CDirReader::Entry &entry, const struct stat *st);
+    void AddWatch (const std::string &path);
+    void MarkDirty(const std::string &path);
+
+    /**
+      * Forget a directory that was deleted or moved away and everything
+      * below it, so it is watched again if it comes back, and mark it
+      * dirty so GetChanges checks the indexed files that were in it
+      */
+    void ForgetDir(const std::string &path);
+
+    CPathMatcher m_matcher;
+    PathMap      m_roots;
+    PathMap      m_paths; /* every directory found by the last Scan, or the monitor since */
+    CFileIndex   m_files;
+    CMerkleTree  m_tree; /* built on demand, cleared when m_files changes */
 
-    typedef std::map   <std::string, bool          > PathMap;
-    typedef std::pair  <std::string, bool          > PathPair;
-    typedef std::map   <std::string, unsigned char*> FileMap;
-    typedef std::pair  <std::string, unsigned char*> FilePair;
+    /* real time monitoring */
+    int          m_fanFD;
+    int          m_inFD;
+    WatchMap     m_watches;
+    DirtyMap     m_dirty; /* a path ending in a slash is a directory that went away */
+    CFileHasher *m_monitorHasher;
 
-    StringList m_exclude;
-    PathMap    m_paths;
-    FileMap    m_files;
+    /* ProcessEvents runs on the event thread while GetChanges hashes on a
+     * worker, only m_dirty is shared between them */
+    pthread_mutex_t m_dirtyLock;
 };
 
 #endif
@@ -0,0 +1,207 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CFileHasher.h"
+#include "CHashFactory.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+/* O_DIRECT needs the buffer, offset and length aligned to the block size */
+#define HASHER_ALIGN 4096
+
+/* pages queried per mincore call, bounds the stack used by GetResident */
+#define RESIDENT_WINDOW 4096
+
+CFileHasher::CFileHasher(const IHashEngine::Type type, const size_t bufferSize/* = 1024 * 1024 */) :
+  m_engine  (CHashFactory::Create(type)),
+  m_buffer  (NULL),
+  m_size    ((bufferSize + HASHER_ALIGN - 1) & ~(HASHER_ALIGN - 1)),
+  m_direct  (false),
+  m_drop    (true),
+  m_governor(NULL)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+
+  void *buffer;
+  if (posix_memalign(&buffer, HASHER_ALIGN, m_size) == 0)
+    m_buffer = (unsigned char *)buffer;
+}
+
+CFileHasher::~CFileHasher()
+{
+  delete m_engine;
+  free(m_buffer);
+}
+
+int CFileHasher::Open(const std::string &path, bool &direct)
+{
+  /* O_NOATIME is only permitted to the owner or CAP_FOWNER, O_NONBLOCK
+   * keeps a FIFO swapped in for the file from blocking the open, it does
+   * not change reads of regular files */
+  int flags = O_RDONLY | O_NOATIME | O_NONBLOCK | O_CLOEXEC;
+  if (direct)
+    flags |= O_DIRECT;
+
+  int fd;
+  while(++m_stats.m_syscalls, (fd = open(path.c_str(), flags)) < 0)
+  {
+    if (errno == EINTR)
+      continue;
+
+    if (errno == EPERM && (flags & O_NOATIME))
+    {
+      flags &= ~O_NOATIME;
+      continue;
+    }
+
+    /* the filesystem does not support O_DIRECT */
+    if (errno == EINVAL && (flags & O_DIRECT))
+    {
+      flags &= ~O_DIRECT;
+      direct = false;
+      continue;
+    }
+
+    return -1;
+  }
+
+  return fd;
+}
+
+size_t CFileHasher::GetResident(const int fd, const size_t size)
+{
+  void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return 0;
+
+  const size_t  page  = sysconf(_SC_PAGESIZE);
+  const size_t  pages = (size + page - 1) / page;
+  unsigned char vec[RESIDENT_WINDOW];
+
+  size_t resident = 0;
+  for(size_t start = 0; start < pages; start += RESIDENT_WINDOW)
+  {
+    const size_t count = pages - start < RESIDENT_WINDOW ?
+      pages - start : RESIDENT_WINDOW;
+
+    if (mincore((char *)map + start * page, count * page, vec) != 0)
+      break;
+
+    for(size_t i = 0; i < count; ++i)
+      if (vec[i] & 1)
+        ++resident;
+  }
+
+  munmap(map, size);
+
+  resident *= page;
+  return resident > size ? size : resident;
+}
+
+bool CFileHasher::HashFile(const std::string &path, unsigned char *digest)
+{
+  if (!m_engine || !m_buffer)
+    return false;
+
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+
+  bool direct = m_direct;
+  int  fd     = Open(path, direct);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  m_stats.m_syscalls += 2; /* the fstat and the close */
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+  {
+    close(fd);
+    return false;
+  }
+
+  /* see how much of the file is cached so we don't evict someone else's data */
+  size_t resident = 0;
+  if (m_drop && !direct && st.st_size > 0)
+  {
+    resident = GetResident(fd, st.st_size);
+    m_stats.m_syscalls += 3;
+  }
+
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  ++m_stats.m_syscalls;
+
+  m_engine->Start();
+
+  uint64_t total = 0;
+  while(true)
+  {
+    /* the final read that finds EOF is not charged for */
+    const uint64_t left = total < (uint64_t)st.st_size ? st.st_size - total : 0;
+    if (m_governor && left > 0)
+      m_governor->Throttle(left < m_size ? left : m_size);
+
+    ++m_stats.m_syscalls;
+    ssize_t len = read(fd, m_buffer, m_size);
+    if (len < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      close(fd);
+      return false;
+    }
+
+    if (len == 0)
+      break;
+
+    m_engine->Update(m_buffer, len);
+    total += len;
+  }
+
+  m_engine->Finish(digest);
+
+  /* only drop the file if none of it was cached before we read it */
+  if (m_drop && !direct && resident == 0)
+  {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ++m_stats.m_syscalls;
+    m_stats.m_dropped += total;
+  }
+
+  close(fd);
+
+  gettimeofday(&end, NULL);
+
+  ++m_stats.m_files;
+  m_stats.m_bytes    += total;
+  m_stats.m_resident += resident;
+  m_stats.m_latency  +=
+    (uint64_t)(end.tv_sec  - start.tv_sec ) * 1000000 +
+              (end.tv_usec - start.tv_usec);
+  return true;
+}
@@ -0,0 +1,93 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CFILEHASHER_H_
+#define _CFILEHASHER_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "IHashEngine.h"
+#include "common/CGovernor.h"
+
+/**
+  * Streams files through a hash engine using large aligned reads while
+  * keeping the page cache as undisturbed as possible
+  */
+class CFileHasher
+{
+  public:
+    struct Stats
+    {
+      uint64_t m_files;
+      uint64_t m_bytes;    /* bytes read from disk                        */
+      uint64_t m_resident; /* bytes that were already in the page cache   */
+      uint64_t m_dropped;  /* bytes we advised the kernel to drop again   */
+      uint64_t m_syscalls; /* system calls made hashing the files         */
+      uint64_t m_latency;  /* microseconds from opening to the digest     */
+    };
+
+    CFileHasher(const IHashEngine::Type type, const size_t bufferSize = 1024 * 1024);
+    ~CFileHasher();
+
+    /**
+      * Bypass the page cache entirely with O_DIRECT where supported
+      */
+    void SetDirect(const bool direct) { m_direct = direct; }
+
+    /**
+      * Drop files we pulled into the page cache once they are hashed
+      */
+    void SetDropCache(const bool drop) { m_drop = drop; }
+
+    /**
+      * Rate limit reads through a governor, NULL for no limit
+      */
+    void SetGovernor(CGovernor *governor) { m_governor = governor; }
+
+    /**
+      * Hash a file
+      * @param path   The file to hash
+      * @param digest Receives the engine's digest
+      * @return       True on success
+      */
+    bool HashFile(const std::string &path, unsigned char *digest);
+
+    const Stats &GetStats() { return m_stats; }
+
+    /**
+      * Returns how many bytes of an open file are in the page cache, this
+      * costs three system calls
+      */
+    static size_t GetResident(const int fd, const size_t size);
+
+  private:
+    IHashEngine   *m_engine;
+    unsigned char *m_buffer;
+    size_t         m_size;
+    bool           m_direct;
+    bool           m_drop;
+    CGovernor     *m_governor;
+    Stats          m_stats;
+
+    int    Open        (const std::string &path, bool &direct);
+};
+
+#endif // _CFILEHASHER_H_
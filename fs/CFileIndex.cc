@@ -0,0 +1,311 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CFileIndex.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+/* the size of each arena block, entries larger than this get their own */
+#define INDEX_BLOCK_SIZE (64 * 1024)
+
+/* walks a path made up of a directory, a separator and a name */
+struct PathCursor
+{
+  const char *m_seg[3];
+  size_t      m_len[3];
+  int         m_cur;
+  size_t      m_off;
+
+  PathCursor(const char *dir, const size_t dirLen, const char *name, const size_t nameLen) :
+    m_cur(0),
+    m_off(0)
+  {
+    m_seg[0] = dir ; m_len[0] = dirLen ;
+    m_seg[1] = "/" ; m_len[1] = 1      ;
+    m_seg[2] = name; m_len[2] = nameLen;
+  }
+
+  PathCursor(const char *path, const size_t len) :
+    m_cur(0),
+    m_off(0)
+  {
+    m_seg[0] = path; m_len[0] = len;
+    m_seg[1] = NULL; m_len[1] = 0  ;
+    m_seg[2] = NULL; m_len[2] = 0  ;
+  }
+
+  bool Next(unsigned char &c)
+  {
+    while(m_cur < 3 && m_off == m_len[m_cur])
+    {
+      ++m_cur;
+      m_off = 0;
+    }
+
+    if (m_cur == 3)
+      return false;
+
+    c = m_seg[m_cur][m_off++];
+    return true;
+  }
+
+  static int Compare(PathCursor &a, PathCursor &b)
+  {
+    unsigned char ca, cb;
+    while(true)
+    {
+      bool ha = a.Next(ca);
+      bool hb = b.Next(cb);
+      if (!ha || !hb)
+        return (int)ha - (int)hb;
+
+      if (ca != cb)
+        return (int)ca - (int)cb;
+    }
+  }
+};
+
+CFileIndex::CFileIndex(const size_t digestLen/* = 16 */) :
+  m_digestLen(digestLen),
+  m_blockUsed(INDEX_BLOCK_SIZE),
+  m_arenaSize(0)
+{
+}
+
+CFileIndex::~CFileIndex()
+{
+  Clear();
+}
+
+void CFileIndex::Clear()
+{
+  for(BlockList::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it)
+    delete[] *it;
+
+  m_blocks .clear();
+  m_entries.clear();
+  m_dirs   .clear();
+  m_dirMap .clear();
+  m_blockUsed = INDEX_BLOCK_SIZE;
+  m_arenaSize = 0;
+}
+
+void CFileIndex::SetDigestLength(const size_t digestLen)
+{
+  Clear();
+  m_digestLen = digestLen;
+}
+
+unsigned char *CFileIndex::Alloc(const size_t size)
+{
+  /* oversized allocations get a block to themselves */
+  if (size > INDEX_BLOCK_SIZE)
+  {
+    unsigned char *block = new unsigned char[size];
+    m_blocks.insert(m_blocks.begin(), block);
+    m_arenaSize += size;
+    return block;
+  }
+
+  if (INDEX_BLOCK_SIZE - m_blockUsed < size)
+  {
+    m_blocks.push_back(new unsigned char[INDEX_BLOCK_SIZE]);
+    m_blockUsed  = 0;
+    m_arenaSize += INDEX_BLOCK_SIZE;
+  }
+
+  unsigned char *ptr = m_blocks.back() + m_blockUsed;
+  m_blockUsed += size;
+  return ptr;
+}
+
+uint32_t CFileIndex::AddDir(const std::string &path)
+{
+  DirMap::const_iterator it = m_dirMap.find(path);
+  if (it != m_dirMap.end())
+    return it->second;
+
+  uint32_t id = m_dirs.size();
+  m_dirs.push_back(path);
+  m_dirMap.insert(std::pair<std::string, uint32_t>(path, id));
+  return id;
+}
+
+unsigned char *CFileIndex::Add(const uint32_t dir, const char *name, const size_t len, const unsigned char *digest)
+{
+  Entry entry;
+  entry.m_data    = Alloc(m_digestLen + len);
+  entry.m_dir     = dir;
+  entry.m_nameLen = len;
+
+  if (digest)
+    memcpy(entry.m_data, digest, m_digestLen);
+  else
+    memset(entry.m_data, 0, m_digestLen);
+  memcpy(entry.m_data + m_digestLen, name, len);
+
+  m_entries.push_back(entry);
+  return entry.m_data;
+}
+
+unsigned char *CFileIndex::Add(const std::string &path, const unsigned char *digest)
+{
+  size_t pos = path.rfind('/');
+  if (pos == std::string::npos)
+    return NULL;
+
+  const uint32_t dir = AddDir(path.substr(0, pos));
+  return Add(dir, path.c_str() + pos + 1, path.length() - pos - 1, digest);
+}
+
+void CFileIndex::Remove(const std::vector<unsigned char *> &digests)
+{
+  if (digests.empty())
+    return;
+
+  std::vector<unsigned char *> sorted(digests);
+  std::sort(sorted.begin(), sorted.end());
+
+  EntryList::iterator out = m_entries.begin();
+  for(EntryList::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+  {
+    if (std::binary_search(sorted.begin(), sorted.end(), it->m_data))
+      continue;
+    *out++ = *it;
+  }
+  m_entries.erase(out, m_entries.end());
+}
+
+int CFileIndex::CompareEntries(const Entry &a, const Entry &b) const
+{
+  const char *na = (const char *)a.m_data + m_digestLen;
+  const char *nb = (const char *)b.m_data + m_digestLen;
+
+  /* files in the same directory only need their names compared */
+  if (a.m_dir == b.m_dir)
+  {
+    int ret = memcmp(na, nb, std::min(a.m_nameLen, b.m_nameLen));
+    if (ret != 0)
+      return ret;
+    return (int)a.m_nameLen - (int)b.m_nameLen;
+  }
+
+  /* differing directories decide the order unless one prefixes the other */
+  const std::string &da = m_dirs[a.m_dir];
+  const std::string &db = m_dirs[b.m_dir];
+  int ret = memcmp(da.c_str(), db.c_str(), std::min(da.length(), db.length()));
+  if (ret != 0)
+    return ret;
+
+  PathCursor ca(da.c_str(), da.length(), na, a.m_nameLen);
+  PathCursor cb(db.c_str(), db.length(), nb, b.m_nameLen);
+  return PathCursor::Compare(ca, cb);
+}
+
+bool CFileIndex::EntryLess::operator()(const Entry &a, const Entry &b) const
+{
+  return m_index->CompareEntries(a, b) < 0;
+}
+
+void CFileIndex::Sort()
+{
+  EntryLess less;
+  less.m_index = this;
+  std::stable_sort(m_entries.begin(), m_entries.end(), less);
+
+  /* keep only the last added of any duplicates */
+  if (m_entries.size() < 2)
+    return;
+
+  EntryList::iterator out = m_entries.begin();
+  for(EntryList::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+  {
+    EntryList::iterator next = it + 1;
+    if (next != m_entries.end() && CompareEntries(*it, *next) == 0)
+      continue;
+    *out++ = *it;
+  }
+  m_entries.erase(out, m_entries.end());
+}
+
+size_t CFileIndex::GetMemoryUsage() const
+{
+  size_t usage = m_arenaSize;
+  usage += m_entries.capacity() * sizeof(Entry);
+  usage += m_blocks .capacity() * sizeof(unsigned char *);
+
+  /* each directory is held once in the list and once as a map key */
+  for(DirList::const_iterator it = m_dirs.begin(); it != m_dirs.end(); ++it)
+    usage += 2 * (sizeof(std::string) + it->capacity() + 1) + sizeof(uint32_t) + 4 * sizeof(void *);
+
+  return usage;
+}
+
+void CFileIndex::GetPath(const size_t index, std::string &path) const
+{
+  const Entry       &entry = m_entries[index];
+  const std::string &dir   = m_dirs[entry.m_dir];
+
+  path.reserve(dir.length() + 1 + entry.m_nameLen);
+  path.assign(dir);
+  path.append("/");
+  path.append((const char *)entry.m_data + m_digestLen, entry.m_nameLen);
+}
+
+std::string CFileIndex::GetPath(const size_t index) const
+{
+  std::string path;
+  GetPath(index, path);
+  return path;
+}
+
+int CFileIndex::Compare(const size_t index, const char *path, const size_t len) const
+{
+  const Entry       &entry = m_entries[index];
+  const std::string &dir   = m_dirs[entry.m_dir];
+
+  PathCursor a(dir.c_str(), dir.length(), (const char *)entry.m_data + m_digestLen, entry.m_nameLen);
+  PathCursor b(path, len);
+  return PathCursor::Compare(a, b);
+}
+
+bool CFileIndex::Find(const std::string &path, size_t &index) const
+{
+  index = LowerBound(path);
+  return index < m_entries.size() && Compare(index, path.c_str(), path.length()) == 0;
+}
+
+size_t CFileIndex::LowerBound(const std::string &path) const
+{
+  size_t lo = 0;
+  size_t hi = m_entries.size();
+  while(lo < hi)
+  {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (Compare(mid, path.c_str(), path.length()) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
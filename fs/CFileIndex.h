@@ -0,0 +1,143 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CFILEINDEX_H_
+#define _CFILEINDEX_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+/**
+  * A compact sorted index of files and their digests.
+  *
+  * Directory prefixes are interned and each file's name and digest are
+  * packed together into large arena blocks, so an entry in the index
+  * itself is only a pointer, a directory id and a name length.
+  */
+class CFileIndex
+{
+  public:
+    CFileIndex(const size_t digestLen = 16);
+    ~CFileIndex();
+
+    /**
+      * Remove all entries and release the arena
+      */
+    void Clear();
+
+    /**
+      * Change the digest length, this clears the index
+      */
+    void SetDigestLength(const size_t digestLen);
+
+    /**
+      * Intern a directory prefix
+      * @param path The directory without a trailing slash
+      * @return     The directory id to pass to Add
+      */
+    uint32_t AddDir(const std::string &path);
+
+    /**
+      * Add a file, the index is unsorted until Sort is called
+      * @param dir    The directory id from AddDir
+      * @param name   The file name within the directory
+      * @param len    The length of name
+      * @param digest The digest to copy in, or NULL to zero fill
+      * @return       A pointer to the entry's digest, valid until Clear
+      */
+    unsigned char *Add(const uint32_t dir, const char *name, const size_t len, const unsigned char *digest);
+    unsigned char *Add(const std::string &path, const unsigned char *digest);
+
+    /**
+      * Remove entries by their digest pointers as returned by Add
+      */
+    void Remove(const std::vector<unsigned char *> &digests);
+
+    /**
+      * Sort the index by path, dropping all but the last added duplicate
+      */
+    void Sort();
+
+    size_t Size() const { return m_entries.size(); }
+    size_t GetDigestLength() const { return m_digestLen; }
+
+    /**
+      * Returns the approximate heap used by the index in bytes
+      */
+    size_t GetMemoryUsage() const;
+
+    void                 GetPath  (const size_t index, std::string &path) const;
+    std::string          GetPath  (const size_t index) const;
+    const unsigned char *GetDigest(const size_t index) const { return m_entries[index].m_data; }
+    unsigned char       *GetDigest(const size_t index)       { return m_entries[index].m_data; }
+
+    /**
+      * Compare an entry's path to another path, as strcmp would
+      */
+    int Compare(const size_t index, const char *path, const size_t len) const;
+
+    /**
+      * Find a path in the sorted index
+      * @param path  The path to find
+      * @param index Receives the entry's index if found
+      * @return      True if found
+      */
+    bool Find(const std::string &path, size_t &index) const;
+
+    /**
+      * Find where a path is, or would be, in the sorted index
+      * @return The index of the first entry not less than the path
+      */
+    size_t LowerBound(const std::string &path) const;
+
+  private:
+    struct Entry
+    {
+      unsigned char *m_data; /* digest followed by the name */
+      uint32_t       m_dir;
+      uint16_t       m_nameLen;
+    };
+
+    typedef std::vector<Entry                > EntryList;
+    typedef std::vector<std::string          > DirList;
+    typedef std::map   <std::string, uint32_t> DirMap;
+    typedef std::vector<unsigned char *      > BlockList;
+
+    struct EntryLess
+    {
+      const CFileIndex *m_index;
+      bool operator()(const Entry &a, const Entry &b) const;
+    };
+
+    size_t    m_digestLen;
+    EntryList m_entries;
+    DirList   m_dirs;
+    DirMap    m_dirMap;
+    BlockList m_blocks;
+    size_t    m_blockUsed;
+    size_t    m_arenaSize;
+
+    unsigned char *Alloc(const size_t size);
+    int CompareEntries(const Entry &a, const Entry &b) const;
+};
+
+#endif // _CFILEINDEX_H_
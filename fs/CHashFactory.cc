@@ -0,0 +1,58 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CHashFactory.h"
+
+#include "common/CCommon.h"
+#include "CMD5HashEngine.h"
+#include "CSHA256HashEngine.h"
+#include "CXXH64HashEngine.h"
+
+IHashEngine *CHashFactory::Create(const IHashEngine::Type type)
+{
+  switch(type)
+  {
+    case IHashEngine::HT_MD5   : return new CMD5HashEngine   ();
+    case IHashEngine::HT_SHA256: return new CSHA256HashEngine();
+    case IHashEngine::HT_XXH64 : return new CXXH64HashEngine ();
+    case IHashEngine::HT_COUNT : break;
+  }
+
+  return NULL;
+}
+
+bool CHashFactory::GetType(const std::string &name, IHashEngine::Type &type)
+{
+  const std::string lower = CCommon::StrToLower(name);
+  for(int i = 0; i < IHashEngine::HT_COUNT; ++i)
+  {
+    IHashEngine *engine = Create((IHashEngine::Type)i);
+    const bool   match  = CCommon::StrToLower(engine->GetName()) == lower;
+    delete engine;
+
+    if (match)
+    {
+      type = (IHashEngine::Type)i;
+      return true;
+    }
+  }
+
+  return false;
+}
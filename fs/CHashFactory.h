@@ -0,0 +1,44 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CHASHFACTORY_H_
+#define _CHASHFACTORY_H_
+
+#include "IHashEngine.h"
+
+#include <string>
+
+class CHashFactory
+{
+  public:
+    /**
+      * Create a new hash engine, the caller must delete it
+      * @return The engine or NULL if the type is unknown
+      */
+    static IHashEngine *Create(const IHashEngine::Type type);
+
+    /**
+      * Look up an engine type by its name (eg, SHA256)
+      * @return false if there is no engine by that name
+      */
+    static bool GetType(const std::string &name, IHashEngine::Type &type);
+};
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CMerkleTree.h"
+#include "CHashFactory.h"
+
+#include <string.h>
+
+CMerkleTree::CMerkleTree() :
+  m_index    (NULL),
+  m_digestLen(0)
+{
+}
+
+CMerkleTree::~CMerkleTree()
+{
+}
+
+void CMerkleTree::Clear()
+{
+  m_index = NULL;
+  m_nodes.clear();
+}
+
+void CMerkleTree::AddChild(IHashEngine *engine, const ChildType type, const char *name, const size_t len, const unsigned char *digest, const size_t digestLen)
+{
+  unsigned char header[3];
+  header[0] = type;
+  header[1] = len & 0xFF;
+  header[2] = (len >> 8) & 0xFF;
+
+  engine->Update(header, sizeof(header));
+  engine->Update((const unsigned char *)name, len);
+  engine->Update(digest, digestLen);
+}
+
+void CMerkleTree::Close(OpenList &open, const size_t depth, const size_t end)
+{
+  while(open.size() > depth)
+  {
+    Open &dir = open.back();
+
+    Node node;
+    node.m_path  = dir.m_path.empty() ? "/" : dir.m_path;
+    node.m_first = dir.m_first;
+    node.m_count = end - dir.m_first;
+    dir.m_engine->Finish(node.m_digest);
+
+    /* the finished directory is the next child of its parent */
+    if (open.size() > 1)
+    {
+      const size_t slash = dir.m_path.rfind('/');
+      AddChild(
+        open[open.size() - 2].m_engine,
+        CT_DIR,
+        dir.m_path.c_str() + slash + 1,
+        dir.m_path.length() - slash - 1,
+        node.m_digest,
+        m_digestLen
+      );
+    }
+
+    m_nodes.insert(std::pair<std::string, Node>(dir.m_path, node));
+    open.pop_back();
+  }
+}
+
+bool CMerkleTree::Build(const CFileIndex &index, const IHashEngine::Type type)
+{
+  Clear();
+  m_digestLen = index.GetDigestLength();
+
+  /* one engine per depth, reused by each directory opened at that depth */
+  std::vector<IHashEngine *> engines;
+  OpenList                   open;
+  std::string                path;
+  bool                       ok = true;
+
+  for(size_t i = 0; i < index.Size() && ok; ++i)
+  {
+    index.GetPath(i, path);
+    const size_t slash = path.rfind('/');
+    if (slash == std::string::npos)
+      continue;
+
+    /* close the open directories that do not contain this file */
+    size_t depth = open.size();
+    while(depth > 0)
+    {
+      const std::string &top = open[depth - 1].m_path;
+      if (slash >= top.length() &&
+          path.compare(0, top.length(), top) == 0 &&
+          (slash == top.length() || path[top.length()] == '/'))
+        break;
+      --depth;
+    }
+    Close(open, depth, i);
+
+    /* open the directories between the deepest open one and the file */
+    size_t pos = open.empty() ? 0 : open.back().m_path.length();
+    for(bool first = open.empty(); first || pos < slash; first = false)
+    {
+      if (!first)
+        pos = path.find('/', pos + 1);
+
+      if (engines.size() <= open.size())
+      {
+        IHashEngine *engine = CHashFactory::Create(type);
+        if (!engine)
+        {
+          ok = false;
+          break;
+        }
+        engines.push_back(engine);
+      }
+
+      Open dir;
+      dir.m_path.assign(path, 0, first ? 0 : pos);
+      dir.m_first  = i;
+      dir.m_engine = engines[open.size()];
+      dir.m_engine->Start();
+      open.push_back(dir);
+    }
+
+    if (ok)
+      AddChild(
+        open.back().m_engine,
+        CT_FILE,
+        path.c_str() + slash + 1,
+        path.length() - slash - 1,
+        index.GetDigest(i),
+        m_digestLen
+      );
+  }
+
+  if (ok)
+  {
+    Close(open, 0, index.Size());
+    m_index = &index;
+  }
+  else
+    m_nodes.clear();
+
+  for(size_t i = 0; i < engines.size(); ++i)
+    delete engines[i];
+
+  return ok;
+}
+
+const CMerkleTree::Node *CMerkleTree::Find(const std::string &path) const
+{
+  NodeMap::const_iterator it = m_nodes.find(path == "/" ? std::string() : path);
+  if (it == m_nodes.end())
+    return NULL;
+  return &it->second;
+}
+
+void CMerkleTree::GetChildren(const Node &node, ChildList &children) const
+{
+  children.clear();
+  if (!m_index)
+    return;
+
+  const std::string prefix = node.m_path == "/" ? "/" : node.m_path + "/";
+  std::string path;
+  for(size_t i = node.m_first; i < node.m_first + node.m_count; ++i)
+  {
+    m_index->GetPath(i, path);
+
+    Child child;
+    const size_t slash = path.find('/', prefix.length());
+    if (slash == std::string::npos)
+    {
+      child.m_type   = CT_FILE;
+      child.m_name   = path.substr(prefix.length());
+      child.m_digest = m_index->GetDigest(i);
+    }
+    else
+    {
+      const Node *sub = Find(path.substr(0, slash));
+      if (!sub)
+        continue;
+
+      child.m_type   = CT_DIR;
+      child.m_name   = path.substr(prefix.length(), slash - prefix.length());
+      child.m_digest = sub->m_digest;
+
+      /* skip over everything below the subdirectory */
+      i += sub->m_count - 1;
+    }
+
+    children.push_back(child);
+  }
+}
@@ -0,0 +1,113 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CMERKLETREE_H_
+#define _CMERKLETREE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "IHashEngine.h"
+#include "CFileIndex.h"
+
+/**
+  * Per directory hash summaries of a sorted file index.
+  *
+  * A directory's digest is the engine's hash over its children in the
+  * order they first appear in the sorted index, each child being a type
+  * byte (0 file, 1 directory), its name as a LE uint16 length and the
+  * bytes, then its digest. Two sides holding the same baseline always
+  * agree on every directory digest, so only differing subtrees need to
+  * be compared.
+  */
+class CMerkleTree
+{
+  public:
+    enum ChildType
+    {
+      CT_FILE = 0,
+      CT_DIR  = 1
+    };
+
+    struct Node
+    {
+      std::string   m_path;
+      size_t        m_first; /* the node's range of entries in the index */
+      size_t        m_count;
+      unsigned char m_digest[HASH_MAX_DIGEST];
+    };
+
+    struct Child
+    {
+      ChildType            m_type;
+      std::string          m_name;
+      const unsigned char *m_digest;
+    };
+
+    typedef std::vector<Child> ChildList;
+
+    CMerkleTree();
+    ~CMerkleTree();
+
+    void Clear();
+
+    /**
+      * Build the tree over an index, the index must be sorted and must
+      * not change while the tree is in use
+      * @return False if the engine could not be created
+      */
+    bool Build(const CFileIndex &index, const IHashEngine::Type type);
+    bool IsBuilt() const { return m_index != NULL; }
+
+    /**
+      * Find a directory's node
+      * @param path The directory, "/" for the root
+      * @return     NULL if there are no files below the directory
+      */
+    const Node *Find(const std::string &path) const;
+
+    /**
+      * List a directory's immediate children in digest order
+      */
+    void GetChildren(const Node &node, ChildList &children) const;
+
+  private:
+    typedef std::map<std::string, Node> NodeMap;
+
+    struct Open
+    {
+      std::string  m_path;
+      size_t       m_first;
+      IHashEngine *m_engine;
+    };
+
+    typedef std::vector<Open> OpenList;
+
+    const CFileIndex *m_index;
+    NodeMap           m_nodes;
+    size_t            m_digestLen;
+
+    static void AddChild(IHashEngine *engine, const ChildType type, const char *name, const size_t len, const unsigned char *digest, const size_t digestLen);
+    void        Close   (OpenList &open, const size_t depth, const size_t end);
+};
+
+#endif // _CMERKLETREE_H_
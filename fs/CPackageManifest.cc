@@ -0,0 +1,285 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CPackageManifest.h"
+#include "CHashFactory.h"
+#include "common/CCommon.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+/* the databases Update watches for changes */
+#define DPKG_INFO "/var/lib/dpkg/info"
+#define RPM_DB    "/var/lib/rpm"
+
+CPackageManifest::CPackageManifest(const IHashEngine::Type type/* = IHashEngine::HT_MD5 */) :
+  m_type     (type),
+  m_digestLen(0   ),
+  m_sorted   (true),
+  m_mtime    (0   )
+{
+  IHashEngine *engine = CHashFactory::Create(type);
+  if (engine)
+  {
+    m_digestLen = engine->GetDigestLength();
+    delete engine;
+  }
+}
+
+CPackageManifest::~CPackageManifest()
+{
+}
+
+void CPackageManifest::Clear()
+{
+  EntryList().swap(m_entries);
+  std::vector<unsigned char>().swap(m_digests);
+  m_sorted = true;
+  m_source.clear();
+}
+
+uint64_t CPackageManifest::HashPath(const char *path, const size_t len)
+{
+  /* FNV-1a */
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for(size_t i = 0; i < len; ++i)
+  {
+    hash ^= (unsigned char)path[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static int HexValue(const char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+void CPackageManifest::Add(const std::string &path, const char *hex, const size_t hexLen, DirMap &dirs)
+{
+  /* digests of another engine can't be compared */
+  if (m_digestLen == 0 || hexLen != m_digestLen * 2)
+    return;
+
+  unsigned char digest[HASH_MAX_DIGEST];
+  bool          zero = true;
+  for(size_t i = 0; i < m_digestLen; ++i)
+  {
+    int hi = HexValue(hex[i * 2]);
+    int lo = HexValue(hex[i * 2 + 1]);
+    if (hi < 0 || lo < 0)
+      return;
+
+    digest[i] = (hi << 4) | lo;
+    if (digest[i])
+      zero = false;
+  }
+
+  /* rpm lists directories and links with an empty digest */
+  if (zero)
+    return;
+
+  /* the scan sees real paths, so resolve the directory the way it would */
+  const size_t slash = path.rfind('/');
+  if (slash == std::string::npos || slash == 0)
+    return;
+
+  std::string      dir  = path.substr(0, slash);
+  DirMap::iterator real = dirs.find(dir);
+  if (real == dirs.end())
+  {
+    char *resolved = realpath(dir.c_str(), NULL);
+    real = dirs.insert(DirMap::value_type(dir, resolved ? resolved : dir)).first;
+    free(resolved);
+  }
+
+  std::string file = real->second;
+  file.append(path, slash, std::string::npos);
+
+  m_entries.push_back(Entry(HashPath(file.c_str(), file.length()), m_digests.size()));
+  m_digests.insert(m_digests.end(), digest, digest + m_digestLen);
+  m_sorted = false;
+}
+
+void CPackageManifest::Sort()
+{
+  if (m_sorted)
+    return;
+
+  std::sort(m_entries.begin(), m_entries.end());
+  m_sorted = true;
+}
+
+bool CPackageManifest::LoadDPKG(const std::string &path/* = "/var/lib/dpkg/info" */)
+{
+  DIR *dh = opendir(path.c_str());
+  if (!dh)
+    return false;
+
+  DirMap dirs;
+  while(struct dirent *dir = readdir(dh))
+  {
+    const size_t len = strlen(dir->d_name);
+    if (len < 8 || strcmp(dir->d_name + len - 8, ".md5sums") != 0)
+      continue;
+
+    /* each line is the hex digest, two spaces and the path relative to / */
+    std::ifstream input((path + "/" + dir->d_name).c_str());
+    std::string   line;
+    while(std::getline(input, line))
+    {
+      const size_t space = line.find("  ");
+      if (space == std::string::npos)
+        continue;
+
+      Add("/" + line.substr(space + 2), line.c_str(), space, dirs);
+    }
+  }
+  closedir(dh);
+
+  Sort();
+  return true;
+}
+
+bool CPackageManifest::LoadRPM(const std::string &rpm/* = "/bin/rpm" */)
+{
+  if (!CCommon::IsFile(rpm))
+    return false;
+
+  std::string result;
+  if (!CCommon::RunCommand(result, rpm, "-qa", "--dump", NULL))
+    return false;
+
+  /*
+   * each line is the path followed by the size, mtime, digest, mode,
+   * owner, group, isconfig, isdoc, rdev and link target, the path may
+   * contain spaces so the fields are counted from the digest onwards
+   */
+  DirMap             dirs;
+  std::istringstream input(result);
+  std::string        line;
+  while(std::getline(input, line))
+  {
+    if (line.empty() || line[0] != '/')
+      continue;
+
+    CCommon::StringList fields;
+    std::istringstream  ss(line);
+    std::string         field;
+    while(ss >> field)
+      fields.push_back(field);
+
+    if (fields.size() < 11)
+      continue;
+
+    const size_t first = fields.size() - 10;
+    const std::string &digest   = fields[first + 2];
+    const std::string &isconfig = fields[first + 6];
+    if (isconfig != "0")
+      continue;
+
+    std::string path = fields[0];
+    for(size_t i = 1; i < first; ++i)
+      path += " " + fields[i];
+
+    Add(path, digest.c_str(), digest.length(), dirs);
+  }
+
+  Sort();
+  return true;
+}
+
+bool CPackageManifest::GetMTime(const std::string &path, const bool files, time_t &mtime)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+    return false;
+
+  mtime = st.st_mtime;
+  if (!files)
+    return true;
+
+  /* rpm updates its database files in place, which the directory does not see */
+  DIR *dh = opendir(path.c_str());
+  if (!dh)
+    return false;
+
+  while(struct dirent *dir = readdir(dh))
+    if (fstatat(dirfd(dh), dir->d_name, &st, 0) == 0 && st.st_mtime > mtime)
+      mtime = st.st_mtime;
+  closedir(dh);
+
+  return true;
+}
+
+bool CPackageManifest::Update()
+{
+  time_t mtime;
+  if (GetMTime(DPKG_INFO, false, mtime))
+  {
+    if (m_source == DPKG_INFO && m_mtime == mtime)
+      return true;
+
+    Clear();
+    if (LoadDPKG(DPKG_INFO))
+    {
+      m_source = DPKG_INFO;
+      m_mtime  = mtime;
+      return true;
+    }
+  }
+
+  if (GetMTime(RPM_DB, true, mtime))
+  {
+    if (m_source == RPM_DB && m_mtime == mtime)
+      return true;
+
+    Clear();
+    if (LoadRPM())
+    {
+      m_source = RPM_DB;
+      m_mtime  = mtime;
+      return true;
+    }
+  }
+
+  Clear();
+  return false;
+}
+
+const unsigned char *CPackageManifest::Find(const char *path, const size_t len) const
+{
+  const uint64_t hash = HashPath(path, len);
+  EntryList::const_iterator it = std::lower_bound(m_entries.begin(), m_entries.end(), Entry(hash, 0));
+  if (it == m_entries.end() || it->first != hash)
+    return NULL;
+
+  return &m_digests[it->second];
+}
@@ -0,0 +1,100 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CPACKAGEMANIFEST_H_
+#define _CPACKAGEMANIFEST_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "IHashEngine.h"
+
+/**
+  * The digests the package manager expects the files it installed to
+  * have, indexed by a hash of each file's real path.
+  *
+  * Only digests of the engine's type are kept, dpkg only records MD5
+  * while rpm records MD5 or SHA-256 depending on its version.
+  */
+class CPackageManifest
+{
+  public:
+    CPackageManifest(const IHashEngine::Type type = IHashEngine::HT_MD5);
+    ~CPackageManifest();
+
+    void Clear();
+
+    /**
+      * Load every package's md5sums from the dpkg database
+      * @param path The dpkg info directory
+      * @return     False if the directory could not be read
+      */
+    bool LoadDPKG(const std::string &path = "/var/lib/dpkg/info");
+
+    /**
+      * Load the file digests from the rpm database, config files are
+      * skipped as they are expected to change
+      * @param rpm The rpm binary
+      * @return    False if rpm could not be run
+      */
+    bool LoadRPM(const std::string &rpm = "/bin/rpm");
+
+    /**
+      * Load the dpkg database, or rpm's if there is none, unless what was
+      * loaded last is still current. A package install changes the dpkg
+      * info directory's mtime or that of a file in the rpm database.
+      * @return False if neither database could be read
+      */
+    bool Update();
+
+    IHashEngine::Type GetType() const { return m_type; }
+    size_t            Size   () const { return m_entries.size(); }
+
+    /**
+      * Find the expected digest of a file
+      * @param path The file's real path
+      * @return     The digest, or NULL if no package owns the file
+      */
+    const unsigned char *Find(const char *path, const size_t len) const;
+
+  private:
+    typedef std::pair<uint64_t, uint32_t>     Entry; /* path hash, digest offset */
+    typedef std::vector<Entry>                EntryList;
+    typedef std::map<std::string, std::string> DirMap;
+
+    IHashEngine::Type          m_type;
+    size_t                     m_digestLen;
+    EntryList                  m_entries;
+    std::vector<unsigned char> m_digests;
+    bool                       m_sorted;
+    std::string                m_source; /* the database Update loaded, empty if none */
+    time_t                     m_mtime;  /* of m_source when it was loaded */
+
+    void Add(const std::string &path, const char *hex, const size_t hexLen, DirMap &dirs);
+    void Sort();
+
+    static uint64_t HashPath(const char *path, const size_t len);
+    static bool     GetMTime(const std::string &path, const bool files, time_t &mtime);
+};
+
+#endif // _CPACKAGEMANIFEST_H_
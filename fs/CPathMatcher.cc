@@ -0,0 +1,193 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CPathMatcher.h"
+
+#include <fnmatch.h>
+
+CPathMatcher::Node::~Node()
+{
+  for(NodeMap::iterator it = m_children.begin(); it != m_children.end(); ++it)
+    delete it->second;
+
+  for(GlobList::iterator it = m_globs.begin(); it != m_globs.end(); ++it)
+    delete it->second;
+}
+
+CPathMatcher::CPathMatcher()
+{
+}
+
+CPathMatcher::~CPathMatcher()
+{
+}
+
+void CPathMatcher::AddInclude(const std::string &pattern)
+{
+  AddRule(pattern, MATCH_INCLUDE);
+}
+
+void CPathMatcher::AddExclude(const std::string &pattern)
+{
+  AddRule(pattern, MATCH_EXCLUDE);
+}
+
+bool CPathMatcher::IsGlob(const std::string &component)
+{
+  return component.find_first_of("*?[") != std::string::npos;
+}
+
+CPathMatcher::Decision CPathMatcher::Combine(const Decision a, const Decision b)
+{
+  if (a == MATCH_INCLUDE || b == MATCH_INCLUDE)
+    return MATCH_INCLUDE;
+
+  if (a == MATCH_EXCLUDE || b == MATCH_EXCLUDE)
+    return MATCH_EXCLUDE;
+
+  return MATCH_NONE;
+}
+
+void CPathMatcher::AddRule(const std::string &pattern, const Decision decision)
+{
+  if (pattern.empty())
+    return;
+
+  if (pattern[0] != '/')
+  {
+    m_names.push_back(std::pair<std::string, Decision>(pattern, decision));
+    return;
+  }
+
+  Node  *node = &m_root;
+  size_t pos  = 1;
+  while(pos < pattern.length())
+  {
+    size_t end = pattern.find('/', pos);
+    if (end == std::string::npos)
+      end = pattern.length();
+
+    const std::string component = pattern.substr(pos, end - pos);
+    pos = end + 1;
+
+    /* ignore empty components from duplicate or trailing slashes */
+    if (component.empty())
+      continue;
+
+    if (IsGlob(component))
+    {
+      Node *next = NULL;
+      for(GlobList::iterator it = node->m_globs.begin(); it != node->m_globs.end(); ++it)
+        if (it->first == component)
+        {
+          next = it->second;
+          break;
+        }
+
+      if (!next)
+      {
+        next = new Node();
+        node->m_globs.push_back(std::pair<std::string, Node *>(component, next));
+      }
+      node = next;
+      continue;
+    }
+
+    NodeMap::iterator it = node->m_children.find(component);
+    if (it == node->m_children.end())
+      it = node->m_children.insert(std::pair<std::string, Node *>(component, new Node())).first;
+    node = it->second;
+  }
+
+  node->m_rule = Combine(node->m_rule, decision);
+}
+
+void CPathMatcher::Start(State &state) const
+{
+  state.m_nodes.clear();
+  state.m_nodes.push_back(&m_root);
+  state.m_decision = m_root.m_rule;
+}
+
+void CPathMatcher::Step(const State &parent, const char *name, State &child) const
+{
+  child.m_nodes.clear();
+  Decision here = MATCH_NONE;
+
+  for(std::vector<const Node *>::const_iterator it = parent.m_nodes.begin(); it != parent.m_nodes.end(); ++it)
+  {
+    const Node *node = *it;
+
+    NodeMap::const_iterator literal = node->m_children.find(name);
+    if (literal != node->m_children.end())
+    {
+      child.m_nodes.push_back(literal->second);
+      here = Combine(here, literal->second->m_rule);
+    }
+
+    for(GlobList::const_iterator glob = node->m_globs.begin(); glob != node->m_globs.end(); ++glob)
+    {
+      if (fnmatch(glob->first.c_str(), name, 0) != 0)
+        continue;
+
+      child.m_nodes.push_back(glob->second);
+      here = Combine(here, glob->second->m_rule);
+    }
+  }
+
+  for(RuleList::const_iterator rule = m_names.begin(); rule != m_names.end(); ++rule)
+    if (fnmatch(rule->first.c_str(), name, 0) == 0)
+      here = Combine(here, rule->second);
+
+  /* rules at this depth override anything inherited from above */
+  child.m_decision = here != MATCH_NONE ? here : parent.m_decision;
+}
+
+CPathMatcher::Decision CPathMatcher::Match(const std::string &path, State &state) const
+{
+  Start(state);
+
+  State  next;
+  size_t pos = 1;
+  while(pos < path.length())
+  {
+    size_t end = path.find('/', pos);
+    if (end == std::string::npos)
+      end = path.length();
+
+    if (end > pos)
+    {
+      const std::string component = path.substr(pos, end - pos);
+      Step(state, component.c_str(), next);
+      state.m_nodes.swap(next.m_nodes);
+      state.m_decision = next.m_decision;
+    }
+
+    pos = end + 1;
+  }
+
+  return state.m_decision;
+}
+
+CPathMatcher::Decision CPathMatcher::Match(const std::string &path) const
+{
+  State state;
+  return Match(path, state);
+}
@@ -0,0 +1,110 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CPATHMATCHER_H_
+#define _CPATHMATCHER_H_
+
+#include <string>
+#include <vector>
+#include <map>
+
+/**
+  * Matches paths against include and exclude rules compiled into a trie
+  * of path components.
+  *
+  * Rules starting with '/' are anchored and apply to the path and
+  * everything below it, each component may be a glob (eg, /lib/modules-*).
+  * Rules without a '/' match the name of a file or directory at any
+  * depth (eg, *.pyc). The deepest matching rule wins, and include wins
+  * over exclude at the same depth.
+  */
+class CPathMatcher
+{
+  public:
+    enum Decision
+    {
+      MATCH_NONE    = 0,
+      MATCH_INCLUDE = 1,
+      MATCH_EXCLUDE = 2
+    };
+
+  private:
+    struct Node;
+
+  public:
+    /**
+      * The result of matching a path, used to match its children one
+      * component at a time
+      */
+    struct State
+    {
+      std::vector<const Node *> m_nodes;
+      Decision                  m_decision;
+    };
+
+    CPathMatcher();
+    ~CPathMatcher();
+
+    void AddInclude(const std::string &pattern);
+    void AddExclude(const std::string &pattern);
+
+    /**
+      * Returns the state for the root directory
+      */
+    void Start(State &state) const;
+
+    /**
+      * Match the next component of a path
+      * @param parent The state of the parent directory
+      * @param name   The name of the file or directory within the parent
+      * @param child  Receives the state of the child
+      */
+    void Step(const State &parent, const char *name, State &child) const;
+
+    /**
+      * Match a whole absolute path
+      */
+    Decision Match(const std::string &path, State &state) const;
+    Decision Match(const std::string &path) const;
+
+  private:
+    typedef std::map   <std::string, Node *> NodeMap;
+    typedef std::vector<std::pair<std::string, Node *> > GlobList;
+    typedef std::vector<std::pair<std::string, Decision> > RuleList;
+
+    struct Node
+    {
+      Node() : m_rule(MATCH_NONE) {}
+      ~Node();
+
+      NodeMap  m_children;
+      GlobList m_globs;
+      Decision m_rule;
+    };
+
+    Node     m_root;
+    RuleList m_names; /* rules that match a name at any depth */
+
+    void AddRule(const std::string &pattern, const Decision decision);
+    static bool     IsGlob (const std::string &component);
+    static Decision Combine(const Decision a, const Decision b);
+};
+
+#endif
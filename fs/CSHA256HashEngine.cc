@@ -0,0 +1,36 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CSHA256HashEngine.h"
+
+void CSHA256HashEngine::Start()
+{
+  sha2_starts(&m_ctx, 0);
+}
+
+void CSHA256HashEngine::Update(const unsigned char *data, const size_t len)
+{
+  sha2_update(&m_ctx, data, len);
+}
+
+void CSHA256HashEngine::Finish(unsigned char *digest)
+{
+  sha2_finish(&m_ctx, digest);
+}
@@ -0,0 +1,42 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CSHA256HASHENGINE_H_
+#define _CSHA256HASHENGINE_H_
+
+#include "IHashEngine.h"
+#include "polarssl/sha2.h"
+
+class CSHA256HashEngine: public IHashEngine
+{
+  public:
+    virtual Type        GetType        () { return HT_SHA256; }
+    virtual const char *GetName        () { return "SHA256"; }
+    virtual size_t      GetDigestLength() { return 32; }
+
+    virtual void Start ();
+    virtual void Update(const unsigned char *data, const size_t len);
+    virtual void Finish(unsigned char *digest);
+
+  private:
+    sha2_context m_ctx;
+};
+
+#endif
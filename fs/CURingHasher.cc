@@ -0,0 +1,466 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CURingHasher.h"
+
+#if defined(HAS_IO_URING)
+
+#include "CHashFactory.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <algorithm>
+
+/* keep the read buffers page aligned */
+#define URING_ALIGN 4096
+
+/* the operations we need, all of which arrived in 5.6 */
+static const unsigned char URING_OPS[] =
+{
+  IORING_OP_OPENAT,
+  IORING_OP_STATX,
+  IORING_OP_READ,
+  IORING_OP_FADVISE,
+  IORING_OP_CLOSE
+};
+
+static uint64_t GetTime()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+CURingHasher::CURingHasher(const IHashEngine::Type type, const unsigned int depth/* = 16 */, const size_t bufferSize/* = 256 * 1024 */) :
+  m_ringFD   (-1  ),
+  m_sqMap    (NULL),
+  m_sqMapSize(0   ),
+  m_cqMap    (NULL),
+  m_cqMapSize(0   ),
+  m_sqes     (NULL),
+  m_sqesSize (0   ),
+  m_toSubmit (0   ),
+  m_pending  (0   ),
+  m_size     ((bufferSize + URING_ALIGN - 1) & ~(URING_ALIGN - 1)),
+  m_drop     (true),
+  m_governor (NULL),
+  m_completed(NULL)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+
+  Slot slot;
+  slot.m_stage  = ST_FREE;
+  slot.m_fd     = -1;
+  slot.m_engine = NULL;
+  slot.m_buffer = NULL;
+  m_slots.resize(depth > 0 ? depth : 1, slot);
+
+  for(SlotList::iterator it = m_slots.begin(); it != m_slots.end(); ++it)
+  {
+    void *buffer;
+    it->m_engine = CHashFactory::Create(type);
+    if (posix_memalign(&buffer, URING_ALIGN, m_size) == 0)
+      it->m_buffer = (unsigned char *)buffer;
+
+    if (!it->m_engine || !it->m_buffer)
+      return;
+  }
+
+  /* a file may have its open and statx, or its fadvise and close queued */
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = syscall(__NR_io_uring_setup, m_slots.size() * 4, &params);
+  if (fd < 0)
+    return;
+
+  /* make sure the kernel knows every operation we use */
+  {
+    const size_t probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, probeSize);
+    bool ok = probe && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for(size_t i = 0; ok && i < sizeof(URING_OPS); ++i)
+      ok = URING_OPS[i] <= probe->last_op && (probe->ops[URING_OPS[i]].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+
+    if (!ok)
+    {
+      close(fd);
+      return;
+    }
+  }
+
+  m_sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  m_cqMapSize = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single)
+    m_sqMapSize = m_cqMapSize = std::max(m_sqMapSize, m_cqMapSize);
+
+  void *map = mmap(NULL, m_sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (map == MAP_FAILED)
+  {
+    close(fd);
+    return;
+  }
+  m_sqMap = map;
+
+  if (single)
+    m_cqMap = m_sqMap;
+  else
+  {
+    map = mmap(NULL, m_cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (map == MAP_FAILED)
+    {
+      close(fd);
+      return;
+    }
+    m_cqMap = map;
+  }
+
+  m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  map = mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (map == MAP_FAILED)
+  {
+    close(fd);
+    return;
+  }
+  m_sqes = (struct io_uring_sqe *)map;
+
+  unsigned char *sq = (unsigned char *)m_sqMap;
+  unsigned char *cq = (unsigned char *)m_cqMap;
+  m_sqHead    = (unsigned *)(sq + params.sq_off.head        );
+  m_sqTail    = (unsigned *)(sq + params.sq_off.tail        );
+  m_sqMask    = (unsigned *)(sq + params.sq_off.ring_mask   );
+  m_sqArray   = (unsigned *)(sq + params.sq_off.array       );
+  m_sqEntries = params.sq_entries;
+  m_cqHead    = (unsigned *)(cq + params.cq_off.head        );
+  m_cqTail    = (unsigned *)(cq + params.cq_off.tail        );
+  m_cqMask    = (unsigned *)(cq + params.cq_off.ring_mask   );
+  m_cqes      = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  m_ringFD = fd;
+}
+
+CURingHasher::~CURingHasher()
+{
+  if (m_ringFD > -1)
+    close(m_ringFD);
+
+  if (m_sqes)
+    munmap(m_sqes, m_sqesSize);
+  if (m_cqMap && m_cqMap != m_sqMap)
+    munmap(m_cqMap, m_cqMapSize);
+  if (m_sqMap)
+    munmap(m_sqMap, m_sqMapSize);
+
+  for(SlotList::iterator it = m_slots.begin(); it != m_slots.end(); ++it)
+  {
+    if (it->m_fd > -1)
+      close(it->m_fd);
+    delete it->m_engine;
+    free(it->m_buffer);
+  }
+}
+
+struct io_uring_sqe *CURingHasher::GetSQE(const unsigned int slot, const Op op)
+{
+  /* if the ring is full hand what we have to the kernel first */
+  unsigned tail = *m_sqTail;
+  __sync_synchronize();
+  if (tail - *(volatile unsigned *)m_sqHead >= m_sqEntries)
+    Enter(0);
+
+  const unsigned index = tail & *m_sqMask;
+  struct io_uring_sqe *sqe = &m_sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data   = ((uint64_t)op << 32) | slot;
+  m_sqArray[index] = index;
+
+  /* the kernel only looks at the entry once we enter, so it can be filled in after */
+  __sync_synchronize();
+  *m_sqTail = tail + 1;
+  ++m_toSubmit;
+  return sqe;
+}
+
+bool CURingHasher::Enter(const unsigned int wait)
+{
+  while(true)
+  {
+    ++m_stats.m_syscalls;
+    int ret = syscall(__NR_io_uring_enter, m_ringFD, m_toSubmit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    m_toSubmit -= ret;
+    return true;
+  }
+}
+
+void CURingHasher::PrepOpen(const unsigned int slot)
+{
+  Slot &s = m_slots[slot];
+  struct io_uring_sqe *sqe = GetSQE(slot, OP_OPEN);
+  sqe->opcode     = IORING_OP_OPENAT;
+  sqe->fd         = AT_FDCWD;
+  sqe->addr       = (uintptr_t)s.m_path.c_str();
+  sqe->open_flags = s.m_flags;
+}
+
+void CURingHasher::PrepRead(const unsigned int slot)
+{
+  Slot &s = m_slots[slot];
+
+  /* the final read that finds EOF is not charged for */
+  const uint64_t size = s.m_statOK ? s.m_statx.stx_size : 0;
+  const uint64_t left = s.m_offset < size ? size - s.m_offset : 0;
+  if (m_governor && left > 0)
+    m_governor->Throttle(left < m_size ? left : m_size);
+
+  struct io_uring_sqe *sqe = GetSQE(slot, OP_READ);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd     = s.m_fd;
+  sqe->addr   = (uintptr_t)s.m_buffer;
+  sqe->len    = m_size;
+  sqe->off    = s.m_offset;
+}
+
+bool CURingHasher::Submit(const std::string &path, unsigned char *digest)
+{
+  if (m_ringFD < 0)
+    return false;
+
+  unsigned int slot = 0;
+  for(; slot < m_slots.size(); ++slot)
+    if (m_slots[slot].m_stage == ST_FREE)
+      break;
+
+  if (slot == m_slots.size())
+    return false;
+
+  /* O_NOATIME is only permitted to the owner or CAP_FOWNER, O_NONBLOCK
+   * keeps a FIFO swapped in for the file from blocking the open */
+  Slot &s = m_slots[slot];
+  s.m_stage    = ST_OPEN;
+  s.m_path     = path;
+  s.m_digest   = digest;
+  s.m_fd       = -1;
+  s.m_flags    = O_RDONLY | O_NOATIME | O_NONBLOCK | O_CLOEXEC;
+  s.m_waiting  = 2;
+  s.m_statOK   = false;
+  s.m_offset   = 0;
+  s.m_resident = 0;
+  s.m_start    = GetTime();
+  s.m_engine->Start();
+
+  /* the size is fetched alongside the open rather than after it */
+  PrepOpen(slot);
+  struct io_uring_sqe *sqe = GetSQE(slot, OP_STATX);
+  sqe->opcode      = IORING_OP_STATX;
+  sqe->fd          = AT_FDCWD;
+  sqe->addr        = (uintptr_t)s.m_path.c_str();
+  sqe->len         = STATX_SIZE;
+  sqe->off         = (uintptr_t)&s.m_statx;
+
+  ++m_pending;
+  return true;
+}
+
+void CURingHasher::Finish(const unsigned int slot, const bool ok, std::vector<unsigned char *> &failed)
+{
+  Slot &s = m_slots[slot];
+  if (ok)
+  {
+    s.m_engine->Finish(s.m_digest);
+
+    ++m_stats.m_files;
+    m_stats.m_bytes    += s.m_offset;
+    m_stats.m_resident += s.m_resident;
+    m_stats.m_latency  += GetTime() - s.m_start;
+
+    if (m_completed)
+      m_completed->push_back(s.m_digest);
+  }
+  else
+    failed.push_back(s.m_digest);
+
+  if (s.m_fd > -1)
+  {
+    /* only drop the file if none of it was cached before we read it */
+    if (ok && m_drop && s.m_resident == 0 && s.m_offset > 0)
+    {
+      struct io_uring_sqe *sqe = GetSQE(slot, OP_OTHER);
+      sqe->opcode         = IORING_OP_FADVISE;
+      sqe->fd             = s.m_fd;
+      sqe->fadvise_advice = POSIX_FADV_DONTNEED;
+      /* a hard link so the close still runs if the fadvise fails, a
+       * cancelled close would leak the descriptor */
+      sqe->flags         |= IOSQE_IO_HARDLINK;
+      m_stats.m_dropped  += s.m_offset;
+    }
+
+    struct io_uring_sqe *sqe = GetSQE(slot, OP_OTHER);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd     = s.m_fd;
+    s.m_fd      = -1;
+  }
+
+  s.m_stage = ST_FREE;
+  --m_pending;
+}
+
+void CURingHasher::Complete(const unsigned int slot, const Op op, const int res, std::vector<unsigned char *> &failed)
+{
+  Slot &s = m_slots[slot];
+  switch(op)
+  {
+    case OP_OPEN:
+      if (res == -EINTR || res == -EAGAIN || (res == -EPERM && (s.m_flags & O_NOATIME)))
+      {
+        s.m_flags &= ~O_NOATIME;
+        PrepOpen(slot);
+        return;
+      }
+
+      s.m_fd = res < 0 ? -1 : res;
+      --s.m_waiting;
+      break;
+
+    case OP_STATX:
+      s.m_statOK = res == 0;
+      --s.m_waiting;
+      break;
+
+    case OP_READ:
+      if (res == -EINTR || res == -EAGAIN)
+      {
+        PrepRead(slot);
+        return;
+      }
+
+      if (res <= 0)
+      {
+        Finish(slot, res == 0, failed);
+        return;
+      }
+
+      s.m_engine->Update(s.m_buffer, res);
+      s.m_offset += res;
+      PrepRead(slot);
+      return;
+
+    case OP_OTHER:
+      return;
+  }
+
+  /* start reading once both the open and the statx are back */
+  if (s.m_stage != ST_OPEN || s.m_waiting > 0)
+    return;
+
+  if (s.m_fd < 0)
+  {
+    Finish(slot, false, failed);
+    return;
+  }
+
+  /* the statx was of the path, check what was actually opened. Reads must
+   * block again or io_uring fails them with EAGAIN rather than waiting */
+  struct stat st;
+  m_stats.m_syscalls += 2;
+  if (fstat(s.m_fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+      fcntl(s.m_fd, F_SETFL, s.m_flags & ~O_NONBLOCK) < 0)
+  {
+    Finish(slot, false, failed);
+    return;
+  }
+
+  /* see how much of the file is cached so we don't evict someone else's data */
+  if (m_drop && s.m_statOK && s.m_statx.stx_size > 0)
+  {
+    s.m_resident = CFileHasher::GetResident(s.m_fd, s.m_statx.stx_size);
+    m_stats.m_syscalls += 3;
+  }
+
+  s.m_stage = ST_READ;
+  PrepRead(slot);
+}
+
+void CURingHasher::Wait(std::vector<unsigned char *> &failed, WorkList &abandoned)
+{
+  if (m_pending == 0)
+    return;
+
+  if (!Enter(1))
+  {
+    /* the ring is unusable, hand back what is in flight for the caller to hash */
+    for(unsigned int i = 0; i < m_slots.size(); ++i)
+    {
+      Slot &s = m_slots[i];
+      if (s.m_stage == ST_FREE)
+        continue;
+
+      abandoned.push_back(std::make_pair(s.m_path, s.m_digest));
+      if (s.m_fd > -1)
+      {
+        close(s.m_fd);
+        s.m_fd = -1;
+      }
+      s.m_stage = ST_FREE;
+    }
+
+    m_pending = 0;
+    close(m_ringFD);
+    m_ringFD = -1;
+    return;
+  }
+
+  unsigned head = *m_cqHead;
+  while(true)
+  {
+    __sync_synchronize();
+    if (head == *(volatile unsigned *)m_cqTail)
+      break;
+
+    const struct io_uring_cqe *cqe = &m_cqes[head & *m_cqMask];
+    const uint64_t data = cqe->user_data;
+    const int      res  = cqe->res;
+
+    /* release the entry before handling it, handling it may queue more work */
+    ++head;
+    __sync_synchronize();
+    *m_cqHead = head;
+
+    Complete(data & 0xFFFFFFFF, (Op)(data >> 32), res, failed);
+  }
+}
+
+#endif // HAS_IO_URING
@@ -0,0 +1,165 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CURINGHASHER_H_
+#define _CURINGHASHER_H_
+
+#if defined(HAS_IO_URING)
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "IHashEngine.h"
+#include "CFileHasher.h"
+#include "common/CGovernor.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/**
+  * Hashes several files at once through an io_uring, keeping the open,
+  * statx and reads of every file in flight queued together so a single
+  * system call submits and reaps the work of many files
+  */
+class CURingHasher
+{
+  public:
+    typedef std::vector<unsigned char *> DigestList;
+
+    /* the path and digest pointer of files submitted but not hashed */
+    typedef std::vector<std::pair<std::string, unsigned char *> > WorkList;
+
+    CURingHasher(const IHashEngine::Type type, const unsigned int depth = 16, const size_t bufferSize = 256 * 1024);
+    ~CURingHasher();
+
+    /**
+      * Returns false if the kernel does not support io_uring, the caller
+      * should fall back to CFileHasher
+      */
+    bool IsReady() const { return m_ringFD > -1; }
+
+    void SetDropCache(const bool drop) { m_drop = drop; }
+    void SetGovernor(CGovernor *governor) { m_governor = governor; }
+
+    /**
+      * Record the digest pointer of each file that hashes successfully
+      * @param completed The list to append to, NULL to stop recording
+      */
+    void SetCompleted(DigestList *completed) { m_completed = completed; }
+
+    unsigned int GetDepth  () const { return m_slots.size(); }
+    unsigned int GetPending() const { return m_pending; }
+
+    /**
+      * Start hashing a file
+      * @param path   The file to hash
+      * @param digest Receives the engine's digest when the file completes
+      * @return       False if all the slots are busy
+      */
+    bool Submit(const std::string &path, unsigned char *digest);
+
+    /**
+      * Submit the queued work and wait for at least one completion
+      * @param failed    Receives the digest pointers of files that failed
+      * @param abandoned Receives the files in flight if the ring fails,
+      *                  they have not failed and must be hashed another way
+      */
+    void Wait(std::vector<unsigned char *> &failed, WorkList &abandoned);
+
+    const CFileHasher::Stats &GetStats() { return m_stats; }
+
+  private:
+    enum Stage
+    {
+      ST_FREE,
+      ST_OPEN,
+      ST_READ
+    };
+
+    enum Op
+    {
+      OP_OPEN  = 0,
+      OP_STATX = 1,
+      OP_READ  = 2,
+      OP_OTHER = 3 /* fadvise and close, their results are not needed */
+    };
+
+    struct Slot
+    {
+      Stage          m_stage;
+      std::string    m_path;
+      unsigned char *m_digest;
+      int            m_fd;
+      int            m_flags;
+      unsigned int   m_waiting;   /* the open and statx still outstanding */
+      bool           m_statOK;
+      struct statx   m_statx;
+      uint64_t       m_offset;
+      size_t         m_resident;
+      IHashEngine   *m_engine;
+      unsigned char *m_buffer;
+      uint64_t       m_start;
+    };
+
+    typedef std::vector<Slot> SlotList;
+
+    int                  m_ringFD;
+    void                *m_sqMap;
+    size_t               m_sqMapSize;
+    void                *m_cqMap;
+    size_t               m_cqMapSize;
+    struct io_uring_sqe *m_sqes;
+    size_t               m_sqesSize;
+
+    unsigned            *m_sqHead;
+    unsigned            *m_sqTail;
+    unsigned            *m_sqMask;
+    unsigned            *m_sqArray;
+    unsigned             m_sqEntries;
+    unsigned             m_toSubmit;
+
+    unsigned            *m_cqHead;
+    unsigned            *m_cqTail;
+    unsigned            *m_cqMask;
+    struct io_uring_cqe *m_cqes;
+
+    SlotList             m_slots;
+    unsigned int         m_pending;
+    size_t               m_size;
+    bool                 m_drop;
+    CGovernor           *m_governor;
+    DigestList          *m_completed;
+    CFileHasher::Stats   m_stats;
+
+    struct io_uring_sqe *GetSQE(const unsigned int slot, const Op op);
+    bool Enter(const unsigned int wait);
+
+    void PrepOpen (const unsigned int slot);
+    void PrepRead (const unsigned int slot);
+    void Finish   (const unsigned int slot, const bool ok, std::vector<unsigned char *> &failed);
+    void Complete (const unsigned int slot, const Op op, const int res, std::vector<unsigned char *> &failed);
+};
+
+#endif // HAS_IO_URING
+#endif // _CURINGHASHER_H_
@@ -0,0 +1,167 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "CXXH64HashEngine.h"
+
+#include <string.h>
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(const uint64_t x, const int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+/* input is always read as LE regardless of the host */
+static inline uint64_t read64(const unsigned char *p)
+{
+  return
+    ((uint64_t)p[0]      ) | ((uint64_t)p[1] <<  8) |
+    ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+    ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+    ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+  return
+    ((uint32_t)p[0]      ) | ((uint32_t)p[1] <<  8) |
+    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t round64(uint64_t acc, const uint64_t input)
+{
+  acc += input * PRIME64_2;
+  acc  = rotl64(acc, 31);
+  acc *= PRIME64_1;
+  return acc;
+}
+
+static inline uint64_t merge64(uint64_t acc, const uint64_t val)
+{
+  acc ^= round64(0, val);
+  acc  = acc * PRIME64_1 + PRIME64_4;
+  return acc;
+}
+
+void CXXH64HashEngine::Start()
+{
+  m_total    = 0;
+  m_buffered = 0;
+  m_acc[0]   = PRIME64_1 + PRIME64_2;
+  m_acc[1]   = PRIME64_2;
+  m_acc[2]   = 0;
+  m_acc[3]   = 0 - PRIME64_1;
+}
+
+void CXXH64HashEngine::Update(const unsigned char *data, const size_t len)
+{
+  const unsigned char *p   = data;
+  const unsigned char *end = data + len;
+  m_total += len;
+
+  /* top up a partial stripe first */
+  if (m_buffered > 0)
+  {
+    size_t fill = sizeof(m_buffer) - m_buffered;
+    if (fill > len)
+      fill = len;
+
+    memcpy(m_buffer + m_buffered, p, fill);
+    m_buffered += fill;
+    p          += fill;
+
+    if (m_buffered < sizeof(m_buffer))
+      return;
+
+    m_acc[0] = round64(m_acc[0], read64(m_buffer +  0));
+    m_acc[1] = round64(m_acc[1], read64(m_buffer +  8));
+    m_acc[2] = round64(m_acc[2], read64(m_buffer + 16));
+    m_acc[3] = round64(m_acc[3], read64(m_buffer + 24));
+    m_buffered = 0;
+  }
+
+  /* the four lanes are independent so the compiler can interleave them */
+  uint64_t v1 = m_acc[0], v2 = m_acc[1], v3 = m_acc[2], v4 = m_acc[3];
+  while(end - p >= 32)
+  {
+    v1 = round64(v1, read64(p +  0));
+    v2 = round64(v2, read64(p +  8));
+    v3 = round64(v3, read64(p + 16));
+    v4 = round64(v4, read64(p + 24));
+    p += 32;
+  }
+  m_acc[0] = v1; m_acc[1] = v2; m_acc[2] = v3; m_acc[3] = v4;
+
+  m_buffered = end - p;
+  memcpy(m_buffer, p, m_buffered);
+}
+
+void CXXH64HashEngine::Finish(unsigned char *digest)
+{
+  uint64_t h;
+  if (m_total >= 32)
+  {
+    h = rotl64(m_acc[0], 1) + rotl64(m_acc[1], 7) + rotl64(m_acc[2], 12) + rotl64(m_acc[3], 18);
+    h = merge64(h, m_acc[0]);
+    h = merge64(h, m_acc[1]);
+    h = merge64(h, m_acc[2]);
+    h = merge64(h, m_acc[3]);
+  }
+  else
+    h = m_acc[2] + PRIME64_5;
+
+  h += m_total;
+
+  const unsigned char *p   = m_buffer;
+  const unsigned char *end = m_buffer + m_buffered;
+  for(; end - p >= 8; p += 8)
+  {
+    h ^= round64(0, read64(p));
+    h  = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+  }
+
+  if (end - p >= 4)
+  {
+    h ^= (uint64_t)read32(p) * PRIME64_1;
+    h  = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+
+  for(; p < end; ++p)
+  {
+    h ^= (*p) * PRIME64_5;
+    h  = rotl64(h, 11) * PRIME64_1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+
+  /* canonical big endian output */
+  for(int i = 7; i >= 0; --i, h >>= 8)
+    digest[i] = h & 0xFF;
+}
@@ -0,0 +1,51 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _CXXH64HASHENGINE_H_
+#define _CXXH64HASHENGINE_H_
+
+#include "IHashEngine.h"
+
+#include <stdint.h>
+
+/**
+  * XXH64, a fast non-cryptographic hash. It will catch corruption and
+  * accidental change but not a deliberate collision, so it is only
+  * suitable as a pre-check.
+  */
+class CXXH64HashEngine: public IHashEngine
+{
+  public:
+    virtual Type        GetType        () { return HT_XXH64; }
+    virtual const char *GetName        () { return "XXH64"; }
+    virtual size_t      GetDigestLength() { return 8; }
+
+    virtual void Start ();
+    virtual void Update(const unsigned char *data, const size_t len);
+    virtual void Finish(unsigned char *digest);
+
+  private:
+    uint64_t      m_total;
+    uint64_t      m_acc[4];
+    unsigned char m_buffer[32];
+    size_t        m_buffered;
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _IHASHENGINE_H_
+#define _IHASHENGINE_H_
+
+#include <stddef.h>
+
+/* the largest digest any engine produces */
+#define HASH_MAX_DIGEST 32
+
+class IHashEngine
+{
+  public:
+    /**
+      * Engine types, these values are stored in baselines so must not change
+      */
+    enum Type
+    {
+      HT_MD5    = 0,
+      HT_SHA256 = 1,
+      HT_XXH64  = 2,
+
+      HT_COUNT
+    };
+
+    virtual ~IHashEngine() {}
+
+    /**
+      * Returns the engine's type
+      */
+    virtual Type GetType() = 0;
+
+    /**
+      * Returns the engine's name (eg, MD5)
+      */
+    virtual const char *GetName() = 0;
+
+    /**
+      * Returns the length of the digest in bytes
+      */
+    virtual size_t GetDigestLength() = 0;
+
+    /**
+      * Begin a new digest
+      */
+    virtual void Start() = 0;
+
+    /**
+      * Hash the next block of input
+      */
+    virtual void Update(const unsigned char *data, const size_t len) = 0;
+
+    /**
+      * Complete the digest
+      * @param digest Receives GetDigestLength() bytes
+      */
+    virtual void Finish(unsigned char *digest) = 0;
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * ARMT (Another Remote Monitoring Tool)
+ * Copyright (C) Geoffrey McRae 2012 <geoff@spacevs.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Drives CScheduler from a fake clock to check each catch up policy when
+ * the clock jumps forward past several runs, as it does when the host
+ * resumes from a suspend. The jobs run from Run as there are no workers.
+ */
+
+#include <stdio.h>
+#include <ctime>
+#include <string>
+
+#include "common/CScheduler.h"
+#include "common/CMetrics.h"
+
+/* seconds between runs, and how far the clock jumps over them */
+#define TEST_INTERVAL 10
+#define TEST_SUSPEND  65
+
+static unsigned int s_failed = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) \
+    { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      ++s_failed; \
+    } \
+  } while(0)
+
+class CFakeClock: public ISchedulerClock
+{
+  public:
+    CFakeClock() : m_now(1000000) {}
+
+    virtual uint64_t GetTime() { return m_now; }
+    void Advance(const uint64_t ms) { m_now += ms; }
+
+  private:
+    uint64_t m_now;
+};
+
+class CCountJob: public ISchedulerJob
+{
+  public:
+    CCountJob(const std::string &name, const CatchUp catchUp) :
+      m_next   (time(NULL)),
+      m_name   (name      ),
+      m_catchUp(catchUp   ),
+      m_runs   (0         )
+    {}
+
+    virtual std::time_t  GetRunTime(                ) { return m_next; }
+    virtual void         SetRunTime(std::time_t time) { m_next = time; }
+    virtual unsigned int GetDelayInterval(          ) { return TEST_INTERVAL; }
+    virtual std::string  GetName         (          ) { return m_name; }
+    virtual CatchUp      GetCatchUp      (          ) { return m_catchUp; }
+    virtual void         Execute         (          ) { ++m_runs; }
+
+    unsigned int GetRuns() { return m_runs; }
+
+  private:
+    std::time_t  m_next;
+    std::string  m_name;
+    CatchUp      m_catchUp;
+    unsigned int m_runs;
+};
+
+/* step the scheduler without letting the clock move */
+static void RunPending(CScheduler &s)
+{
+  for(int i = 0; i < 10; ++i)
+    s.Run(0);
+}
+
+/**
+ * Run a job on schedule twice, jump the clock over several runs and check
+ * the runs made to catch up and the runs counted as missed
+ * @param name    The job's name
+ * @param catchUp The policy under test
+ * @param runs    The runs expected on resuming
+ * @param missed  The job.<name>.missed count expected
+ */
+static void TestCatchUp(const std::string &name, const ISchedulerJob::CatchUp catchUp,
+  const unsigned int runs, const uint64_t missed)
+{
+  CFakeClock clock;
+  CScheduler s;
+  s.SetClock(&clock);
+
+  CCountJob *job = new CCountJob(name, catchUp);
+  const std::time_t first = job->GetRunTime();
+  s.AddJob(job);
+
+  /* on schedule */
+  RunPending(s);
+  CHECK(job->GetRuns() == 1);
+
+  clock.Advance(TEST_INTERVAL * 1000);
+  RunPending(s);
+  CHECK(job->GetRuns() == 2);
+
+  /* the runs due at 20s to 70s are all missed, the next is due at 80s */
+  clock.Advance(TEST_SUSPEND * 1000);
+  RunPending(s);
+  CHECK(job->GetRuns() == 2 + runs);
+  CHECK(CMetrics::Get("job." + name + ".missed") == missed);
+
+  /* whatever the policy the schedule keeps its phase */
+  CHECK(job->GetRunTime() == first + 8 * TEST_INTERVAL);
+
+  clock.Advance(4 * 1000);
+  RunPending(s);
+  CHECK(job->GetRuns() == 2 + runs);
+
+  clock.Advance(1 * 1000);
+  RunPending(s);
+  CHECK(job->GetRuns() == 3 + runs);
+  CHECK(CMetrics::Get("job." + name + ".missed") == missed);
+
+  printf("%-10s %u runs to catch up, %llu missed\n",
+    name.c_str(), runs, (unsigned long long)missed);
+}
+
+/* a jump shorter than the interval is not a missed run */
+static void TestLate()
+{
+  CFakeClock clock;
+  CScheduler s;
+  s.SetClock(&clock);
+
+  CCountJob *job = new CCountJob("late", ISchedulerJob::CATCHUP_SKIP);
+  s.AddJob(job);
+  RunPending(s);
+
+  clock.Advance((TEST_INTERVAL * 2 - 1) * 1000);
+  RunPending(s);
+  CHECK(job->GetRuns() == 2);
+  CHECK(CMetrics::Get("job.late.missed") == 0);
+
+  printf("%-10s late run is not missed\n", "late");
+}
+
+int main(int argc, char *argv[])
+{
+  TestCatchUp("all"     , ISchedulerJob::CATCHUP_ALL     , 6, 0);
+  TestCatchUp("coalesce", ISchedulerJob::CATCHUP_COALESCE, 1, 5);
+  TestCatchUp("skip"    , ISchedulerJob::CATCHUP_SKIP    , 0, 6);
+  TestLate();
+
+  if (s_failed > 0)
+  {
+    fprintf(stderr, "%u checks failed\n", s_failed);
+    return 1;
+  }
+
+  printf("all checks passed\n");
+  return 0;
+}